@@ -0,0 +1,337 @@
+/*
+ * Firmware image tool of the mxu11x0 driver.
+ *
+ * The images in the mxu11x0 *_fw.h files start with a three byte
+ * placeholder for the firmware header.  This tool pads each image the
+ * way the driver does and fills in wLength and bCheckSum, giving the
+ * exact byte stream the boot loader receives.
+ *
+ *	mxu1_fwtool header		built-in table for the driver, to stdout
+ *	mxu1_fwtool images <dir>	write <dir>/moxa-XXXX.fw and a manifest
+ *	mxu1_fwtool verify <file>...	check packed moxa-XXXX.fw images
+ *
+ * Build on the host with: cc -o mxu1_fwtool mxu1_fwtool.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mxu1110_fw.h"
+#include "mxu1130_fw.h"
+#include "mxu1131_fw.h"
+#include "mxu1150_fw.h"
+#include "mxu1151_fw.h"
+
+/* Size of struct mxu1_firmware_header, also the padding the driver adds */
+#define MXU1_FW_HEADER_SIZE	3
+
+#define MXU1_FW_MANIFEST	"moxa-fw.manifest"
+
+struct mxu1_fw_source {
+	unsigned int model;
+	const unsigned char *data;
+	size_t size;
+};
+
+static const struct mxu1_fw_source sources[] = {
+	{ 0x1110, mxu1110FWImage, sizeof(mxu1110FWImage) },
+	{ 0x1130, mxu1130FWImage, sizeof(mxu1130FWImage) },
+	{ 0x1131, mxu1131FWImage, sizeof(mxu1131FWImage) },
+	{ 0x1150, mxu1150FWImage, sizeof(mxu1150FWImage) },
+	{ 0x1151, mxu1151FWImage, sizeof(mxu1151FWImage) },
+};
+
+#define NUM_SOURCES	(sizeof(sources) / sizeof(sources[0]))
+
+static unsigned char mxu1_fw_sum(const unsigned char *data, size_t size)
+{
+	unsigned char cs = 0;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		cs = (unsigned char)(cs + data[i]);
+
+	return cs;
+}
+
+/* CRC-32 (IEEE 802.3), to identify an image in the manifest */
+static unsigned long mxu1_fw_crc32(const unsigned char *data, size_t size)
+{
+	unsigned long crc = 0xffffffff;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc & 0xffffffff;
+}
+
+/*
+ * Build the download image of src: the source padded with 0xff, the
+ * little endian payload length and the 8-bit sum of the payload in front.
+ */
+static unsigned char *mxu1_fw_build(const struct mxu1_fw_source *src,
+				    size_t *size)
+{
+	unsigned char *image;
+	unsigned char cs;
+	size_t len;
+
+	if (src->size < MXU1_FW_HEADER_SIZE)
+		return NULL;
+
+	len = src->size + MXU1_FW_HEADER_SIZE;
+	if (len - MXU1_FW_HEADER_SIZE > 0xffff)
+		return NULL;
+
+	image = malloc(len);
+	if (!image)
+		return NULL;
+
+	memcpy(image, src->data, src->size);
+	memset(image + src->size, 0xff, MXU1_FW_HEADER_SIZE);
+
+	cs = mxu1_fw_sum(image + MXU1_FW_HEADER_SIZE,
+			 len - MXU1_FW_HEADER_SIZE);
+
+	image[0] = (len - MXU1_FW_HEADER_SIZE) & 0xff;
+	image[1] = (len - MXU1_FW_HEADER_SIZE) >> 8;
+	image[2] = cs;
+
+	*size = len;
+
+	return image;
+}
+
+/* Check the header of a packed image; returns NULL or what is wrong */
+static const char *mxu1_fw_check(const unsigned char *image, size_t size)
+{
+	size_t len;
+
+	if (size <= MXU1_FW_HEADER_SIZE)
+		return "too short";
+
+	len = image[0] | (image[1] << 8);
+	if (len != size - MXU1_FW_HEADER_SIZE)
+		return "wLength does not match the image size";
+
+	if (image[2] != mxu1_fw_sum(image + MXU1_FW_HEADER_SIZE, len))
+		return "bad bCheckSum";
+
+	return NULL;
+}
+
+static void mxu1_fw_emit(FILE *out, unsigned int model,
+			 const unsigned char *image, size_t size)
+{
+	size_t i;
+
+	fprintf(out, "static const u8 mxu1_fw_%04x[] = {", model);
+	for (i = 0; i < size; i++) {
+		if (i % 12 == 0)
+			fprintf(out, "\n\t");
+		else
+			fputc(' ', out);
+		fprintf(out, "0x%02x,", image[i]);
+	}
+	fprintf(out, "\n};\n\n");
+}
+
+static int mxu1_fw_header(FILE *out)
+{
+	unsigned char *image;
+	size_t size;
+	size_t i;
+
+	fprintf(out, "/* Generated by firmware/mxu1_fwtool, do not edit */\n\n");
+
+	for (i = 0; i < NUM_SOURCES; i++) {
+		image = mxu1_fw_build(&sources[i], &size);
+		if (!image) {
+			fprintf(stderr, "mxu1_fwtool: bad image for model %04x\n",
+				sources[i].model);
+			return 1;
+		}
+
+		mxu1_fw_emit(out, sources[i].model, image, size);
+		free(image);
+	}
+
+	fprintf(out, "static const struct mxu1_fw_builtin mxu1_fw_builtin[] = {\n");
+	for (i = 0; i < NUM_SOURCES; i++) {
+		fprintf(out, "\t{ 0x%04x, mxu1_fw_%04x, sizeof(mxu1_fw_%04x) },\n",
+			sources[i].model, sources[i].model, sources[i].model);
+	}
+	fprintf(out, "};\n");
+
+	return 0;
+}
+
+/*
+ * Write the packed images and a manifest with one line per image: file,
+ * size, wLength, bCheckSum and CRC-32 of the whole file.  The images
+ * carry no version of their own; the driver reports the version of the
+ * running firmware in the firmware_info port attribute.
+ */
+static int mxu1_fw_images(const char *dir)
+{
+	char path[4096];
+	unsigned char *image;
+	FILE *manifest;
+	FILE *out;
+	size_t size;
+	size_t i;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, MXU1_FW_MANIFEST);
+	manifest = fopen(path, "w");
+	if (!manifest) {
+		perror(path);
+		return 1;
+	}
+
+	fprintf(manifest, "# file size wLength bCheckSum crc32\n");
+
+	for (i = 0; i < NUM_SOURCES && !ret; i++) {
+		image = mxu1_fw_build(&sources[i], &size);
+		if (!image) {
+			fprintf(stderr, "mxu1_fwtool: bad image for model %04x\n",
+				sources[i].model);
+			ret = 1;
+			break;
+		}
+
+		snprintf(path, sizeof(path), "%s/moxa-%04x.fw", dir,
+			 sources[i].model);
+		out = fopen(path, "wb");
+		if (!out || fwrite(image, size, 1, out) != 1) {
+			perror(path);
+			ret = 1;
+		}
+		if (out && fclose(out)) {
+			perror(path);
+			ret = 1;
+		}
+
+		fprintf(manifest, "moxa-%04x.fw %zu %zu 0x%02x 0x%08lx\n",
+			sources[i].model, size, size - MXU1_FW_HEADER_SIZE,
+			image[2], mxu1_fw_crc32(image, size));
+		free(image);
+	}
+
+	if (fclose(manifest)) {
+		perror(MXU1_FW_MANIFEST);
+		ret = 1;
+	}
+
+	return ret;
+}
+
+static unsigned char *mxu1_fw_read(const char *path, size_t *size)
+{
+	unsigned char *data;
+	FILE *in;
+	long len;
+
+	in = fopen(path, "rb");
+	if (!in)
+		return NULL;
+
+	if (fseek(in, 0, SEEK_END) || (len = ftell(in)) < 0 ||
+	    fseek(in, 0, SEEK_SET)) {
+		fclose(in);
+		return NULL;
+	}
+
+	data = malloc(len ? len : 1);
+	if (data && fread(data, 1, len, in) != (size_t)len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(in);
+
+	*size = len;
+
+	return data;
+}
+
+/*
+ * Verify packed images: the header must describe the file, and an image
+ * named after a known model must match the one built from its source.
+ */
+static int mxu1_fw_verify(int argc, char **argv)
+{
+	const char *name, *err;
+	unsigned char *image, *ref;
+	unsigned int model;
+	size_t size, ref_size;
+	size_t i;
+	int ret = 0;
+	int n;
+
+	for (n = 0; n < argc; n++) {
+		image = mxu1_fw_read(argv[n], &size);
+		if (!image) {
+			perror(argv[n]);
+			ret = 1;
+			continue;
+		}
+
+		err = mxu1_fw_check(image, size);
+
+		name = strrchr(argv[n], '/');
+		name = name ? name + 1 : argv[n];
+
+		if (!err && sscanf(name, "moxa-%4x.fw", &model) == 1) {
+			for (i = 0; i < NUM_SOURCES; i++) {
+				if (sources[i].model != model)
+					continue;
+
+				ref = mxu1_fw_build(&sources[i], &ref_size);
+				if (!ref)
+					err = "cannot build reference image";
+				else if (ref_size != size ||
+					 memcmp(ref, image, size))
+					err = "differs from the shipped image";
+				free(ref);
+			}
+		}
+
+		printf("%s: %s\n", argv[n], err ? err : "ok");
+		if (err)
+			ret = 1;
+
+		free(image);
+	}
+
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mxu1_fwtool header\n"
+		"       mxu1_fwtool images <dir>\n"
+		"       mxu1_fwtool verify <file>...\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "header"))
+		return mxu1_fw_header(stdout);
+
+	if (argc == 3 && !strcmp(argv[1], "images"))
+		return mxu1_fw_images(argv[2]);
+
+	if (argc >= 3 && !strcmp(argv[1], "verify"))
+		return mxu1_fw_verify(argc - 2, argv + 2);
+
+	usage();
+
+	return 2;
+}
@@ -22,13 +22,17 @@
 
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/debugfs.h>
 #include <linux/firmware.h>
 #include <linux/jiffies.h>
+#include <linux/kfifo.h>
+#include <linux/pm_runtime.h>
 #include <linux/serial.h>
 #include <linux/serial_reg.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/seq_file.h>
 #include <linux/tty.h>
 #include <linux/tty_driver.h>
 #include <linux/tty_flip.h>
@@ -90,6 +94,9 @@
 #define MXU1_LSR_RX_FULL			0x10
 #define MXU1_LSR_TX_EMPTY			0x20
 
+/* Line control */
+#define MXU1_LCR_BREAK				0x40
+
 /* Modem control */
 #define MXU1_MCR_LOOP				0x04
 #define MXU1_MCR_DTR				0x10
@@ -139,6 +146,24 @@
 #define MXU1_PIPE_TIMEOUT_MASK			0x7C
 #define MXU1_PIPE_TIMEOUT_ENABLE		0x80
 
+/* User defined ioctls, see mxu11x0.h */
+#define MOXA					404
+#define MOXA_GET_MSR_EVENTS			(MOXA + 2)
+
+/* One modem status change, msr including the delta bits */
+struct mxu1_msr_event {
+	__u64	timestamp_ns;	/* CLOCK_MONOTONIC */
+	__u8	msr;
+	__u8	reserved[7];
+};
+
+/* Argument of MOXA_GET_MSR_EVENTS */
+struct mxu1_msr_events {
+	__u32	count;		/* in: room in events, out: events returned */
+	__u32	dropped;	/* out: events lost since the last call */
+	__u64	events;		/* user pointer to struct mxu1_msr_event[] */
+};
+
 /* Config struct */
 struct mxu1_uart_config {
 	__be16	wBaudRate;
@@ -151,6 +176,20 @@ struct mxu1_uart_config {
 	u8	bUartMode;
 } __packed;
 
+/* Port status reply to MXU1_GET_PORT_STATUS */
+struct mxu1_port_status {
+	u8 bCmdCode;
+	u8 bModuleId;
+	u8 bErrorCode;
+	u8 bMSR;
+	u8 bLSR;
+} __packed;
+
+/* Output queue reply to MXU1_GET_OUTQUEUE */
+struct mxu1_outqueue {
+	__be16 wCount;
+} __packed;
+
 /* Purge modes */
 #define MXU1_PURGE_OUTPUT			0x00
 #define MXU1_PURGE_INPUT			0x80
@@ -199,25 +238,303 @@ struct mxu1_firmware_header {
 } __packed;
 
 #define MXU1_UART_BASE_ADDR	    0xFFA0
+#define MXU1_UART_OFFSET_LCR	    0x0002
 #define MXU1_UART_OFFSET_MCR	    0x0004
 
 #define MXU1_BAUD_BASE              923077
 
 #define MXU1_TRANSFER_TIMEOUT	    2
-#define MXU1_DOWNLOAD_TIMEOUT       1000
+#define MXU1_LOW_LATENCY_TIMEOUT    1
+#define MXU1_TRANSFER_TIMEOUT_MAX   (MXU1_PIPE_TIMEOUT_MASK >> 2)
+#define MXU1_DOWNLOAD_TIMEOUT       1000 /* per chunk, in ms */
 #define MXU1_DEFAULT_CLOSING_WAIT   4000 /* in .01 secs */
 
+/* Adaptive pipe timeout */
+#define MXU1_ADAPT_LONG_TIMEOUT	    16
+#define MXU1_ADAPT_WINDOW	    (HZ / 10)
+#define MXU1_ADAPT_HISTORY	    16
+
+/*
+ * The image is sent in chunks of whole endpoint packets, all queued at
+ * once.  The boot loader sees the same packet stream as with one
+ * MXU1_DOWNLOAD_MAX_PACKET_SIZE transfer at a time.
+ */
+#define MXU1_DOWNLOAD_CHUNK_SIZE    4096
+#define MXU1_DOWNLOAD_SETTLE	    100	/* wait before reset, in ms */
+
+/* Devices reset after a download, to time their re-enumeration */
+#define MXU1_REENUM_SLOTS	    8
+
+/* Layout of the packed modem status word */
+#define MXU1_MODEM_MSR_SHIFT	    0
+#define MXU1_MODEM_MCR_SHIFT	    8
+
+/* Interrupt-in transfers carry one or more records of this size */
+#define MXU1_INT_RECORD_SIZE	    2
+
+/* Modem status changes kept per port until read, a power of two */
+#define MXU1_MSR_RING_SIZE	    64
+
+/* Break requests whose issue time is tracked for latency statistics */
+#define MXU1_BREAK_INFLIGHT	    4
+
+/* Bulk-in receive ring, configurable per port through sysfs */
+#define MXU1_RX_URBS_DEFAULT	    4
+#define MXU1_RX_URBS_MAX	    16
+#define MXU1_RX_URB_SIZE_DEFAULT    256
+#define MXU1_RX_URB_SIZE_MIN	    64
+#define MXU1_RX_URB_SIZE_MAX	    4096
+
+/* Bulk-out transmit engine, depth configurable per port through sysfs */
+#define MXU1_TX_URBS_DEFAULT	    4
+#define MXU1_TX_URBS_MAX	    8
+#define MXU1_TX_URB_SIZE	    512
+
+/* Upper bound of the per port close linger window, in ms */
+#define MXU1_CLOSE_LINGER_MAX	    60000
+
+/* One pipe timeout change of the adaptive timeout */
+struct mxu1_timeout_change {
+	s64 time_ms;
+	u8 from;
+	u8 to;
+	unsigned int fill;
+};
+
+/* Issue time of a break request, seq tells which request it belongs to */
+struct mxu1_break_stamp {
+	ktime_t issued;
+	unsigned int seq;
+};
+
 struct mxu1_port {
-	u8 msr;
+	/*
+	 * msr and mcr packed into one word, so that readers get a
+	 * consistent snapshot without taking any lock.  mcr also has its
+	 * own copy below, protected by mutex.
+	 */
+	atomic_t modem;
 	u8 mcr;
 	u8 uart_mode;
-	spinlock_t spinlock; /* Protects msr */
-	struct mutex mutex; /* Protects mcr */
+	spinlock_t spinlock; /* Protects latency statistics */
+	struct mutex mutex; /* Protects mcr, config, dev_open and dev_settings */
 	bool send_break;
+
+	/* last wire-level state sent to the device, to skip no-op writes */
+	struct mxu1_uart_config config;
+	bool config_valid;
+	bool mcr_valid;
+
+	/* queued vendor requests whose completion writes to this port */
+	atomic_t ctrl_pending;
+
+	/*
+	 * break on/off latency, from break_ctl to the LCR write completing.
+	 * Requests complete in order; one issued while every slot was in
+	 * use has no stamp and is left out of the statistics.
+	 */
+	struct mxu1_break_stamp break_issued[MXU1_BREAK_INFLIGHT];
+	unsigned int break_head;
+	unsigned int break_tail;
+	unsigned int break_seq;
+	unsigned int break_done;
+	unsigned long break_count;
+	s64 break_last_us;
+	s64 break_max_us;
+	s64 break_total_us;
+
+	/* open() latency, from the first request to the ring being live */
+	unsigned long open_count;
+	unsigned long open_lingered;
+	s64 open_last_us;
+	s64 open_min_us;
+	s64 open_max_us;
+	s64 open_total_us;
+	u32 flags;
+	u8 pipe_timeout;
+	struct usb_serial_port *port;
+	speed_t baud;
+
+	/* receive ring, sized at open from rx_urb_count and rx_urb_size */
+	spinlock_t rx_lock; /* Protects rx_throttled and adaptive state */
+	struct urb *rx_urbs[MXU1_RX_URBS_MAX];
+	unsigned int rx_urbs_alloc;
+	unsigned int rx_urb_count;
+	unsigned int rx_urb_size;
+	struct usb_anchor rx_parked;
+	bool rx_throttled;
+
+	unsigned long rx_completions;
+	unsigned long rx_full;
+	unsigned long rx_bytes;
+	unsigned long rx_errors;
+
+	/* adaptive pipe timeout, driven from the bulk-in completions */
+	bool adaptive;
+	u8 cur_timeout;
+	unsigned long adapt_start;
+	unsigned int adapt_completions;
+	unsigned int adapt_bytes;
+	struct work_struct adapt_work;
+	struct mxu1_timeout_change history[MXU1_ADAPT_HISTORY];
+	unsigned int history_count;
+
+	/* transmit engine, fed from port->write_fifo */
+	struct urb *tx_urbs[MXU1_TX_URBS_MAX];
+	unsigned long tx_urbs_free; /* Protected by port->lock */
+	unsigned long tx_busy;
+	unsigned int tx_urbs_alloc;
+	unsigned int tx_urb_count;
+	unsigned int tx_inflight;
+	unsigned int tx_inflight_max;
+
+	unsigned long tx_submitted;
+	unsigned long tx_total_bytes; /* port->tx_bytes counts those in flight */
+	unsigned long tx_depth_sum;
+	unsigned long tx_saturated;
+	unsigned long tx_errors;
+
+	/*
+	 * Estimate of when the device will have shifted out everything
+	 * handed to it so far, refined by MXU1_GET_OUTQUEUE while draining.
+	 */
+	ktime_t tx_drain_end; /* Protected by port->lock */
+	unsigned int tx_dev_queued;
+	struct delayed_work drain_work;
+
+	/*
+	 * Close linger: the device side port stays open and started for
+	 * close_linger ms after the last close, so that a quick reopen
+	 * skips the open handshake.
+	 */
+	unsigned int close_linger;
+	bool dev_open;
+	u16 dev_settings;
+	struct delayed_work linger_work;
+
+	/*
+	 * Modem status change ring.  The interrupt urbs, whose completions
+	 * are serialized, are the only producer and advance msr_head;
+	 * readers, serialized by msr_ring_mutex, advance msr_tail.  A full
+	 * ring drops new events.
+	 */
+	struct mxu1_msr_event msr_ring[MXU1_MSR_RING_SIZE];
+	unsigned int msr_head;
+	unsigned int msr_tail;
+	atomic_t msr_dropped;
+	struct mutex msr_ring_mutex;
+
+	/* modem_status attribute, notified on every modem line change */
+	struct kernfs_node *modem_kn;
+
+	/* statistics file in debugfs */
+	struct dentry *debugfs;
+
+	/*
+	 * Second interrupt-in urb, queued behind port->interrupt_in_urb so
+	 * that the endpoint is still polled while one of them is being
+	 * processed and resubmitted.
+	 */
+	struct urb *int_urb;
+
+	/* interrupt statistics, updated from interrupt completions only */
+	unsigned long int_records;
+	unsigned long int_malformed;
+	unsigned long int_hw_errors;
+	unsigned long int_unknown;
+	unsigned long int_urb_errors;
+};
+
+/* Preallocated vendor requests per device */
+#define MXU1_CTRL_POOL_SIZE	    16
+#define MXU1_CTRL_MAX_DATA	    16
+
+/* Control timeout budgets, in ms */
+#define MXU1_CTRL_TIMEOUT_SHORT	    500	 /* register, purge and status */
+#define MXU1_CTRL_TIMEOUT_PORT	    2000 /* port state and configuration */
+
+static unsigned int ctrl_timeout;
+module_param(ctrl_timeout, uint, 0644);
+MODULE_PARM_DESC(ctrl_timeout,
+		 "Timeout of every vendor request in ms (0 = per-command budgets)");
+
+typedef void (*mxu1_ctrl_complete_t)(void *context, int status);
+
+/* A vendor request waiting in, or issued from, the per-device queue */
+struct mxu1_ctrl_req {
+	struct list_head list;
+	struct mxu1_device *mxdev;
+	struct urb *urb;
+	struct usb_ctrlrequest *setup;
+	u8 *data;
+	size_t size;
+	unsigned int timeout; /* in ms */
+	bool timed_out;
+	bool quiet; /* failure is expected, only log it at debug level */
+	int status;
+	ktime_t start;
+
+	/* synchronous callers wait on done and free the request themselves */
+	bool sync;
+	struct completion done;
+	mxu1_ctrl_complete_t complete;
+	void *context;
+	struct mxu1_ctrl_batch *batch;
+};
+
+/*
+ * Reply to MXU1_GET_VERSION.  Only a running firmware answers, so the
+ * reply serves as a liveness check; its two bytes are reported in
+ * debugfs but not interpreted.
+ */
+struct mxu1_fw_version {
+	u8 bMajor;
+	u8 bMinor;
+} __packed;
+
+/*
+ * A set of queued vendor requests waited for as a whole.  Once one of
+ * them fails, the ones behind it are not issued.
+ */
+struct mxu1_ctrl_batch {
+	atomic_t pending;
+	int status;
+	bool failed; /* Protected by ctrl_lock */
+	struct completion done;
 };
 
 struct mxu1_device {
 	u16 mxd_model;
+	struct usb_serial *serial;
+
+	/* vendor requests are issued one at a time, in submission order */
+	spinlock_t ctrl_lock; /* Protects ctrl_queue, ctrl_active, ctrl_dead */
+	struct list_head ctrl_queue;
+	struct mxu1_ctrl_req *ctrl_active;
+	bool ctrl_dead;
+	struct timer_list ctrl_timer;
+	unsigned long ctrl_deadline;
+
+	/* vendor request statistics, protected by ctrl_lock */
+	unsigned long ctrl_requests;
+	unsigned long ctrl_issued;
+	unsigned long ctrl_errors;
+	unsigned long ctrl_timeouts;
+	unsigned long ctrl_dropped;
+	u8 ctrl_last_timeout;
+	s64 ctrl_total_us;
+	s64 ctrl_max_us;
+
+	/* request pool, so that no vendor request touches the allocator */
+	struct mxu1_ctrl_req ctrl_pool[MXU1_CTRL_POOL_SIZE];
+	struct list_head ctrl_free; /* Protected by ctrl_lock */
+	wait_queue_head_t ctrl_wait;
+
+	/* running firmware and recoveries from a reset during resume */
+	struct mxu1_fw_version fw_version;
+	bool fw_version_valid;
+	unsigned long recoveries;
+	s64 recovery_last_us;
 };
 
 static const struct usb_device_id mxu1_idtable[] = {
@@ -231,668 +548,3264 @@ static const struct usb_device_id mxu1_idtable[] = {
 
 MODULE_DEVICE_TABLE(usb, mxu1_idtable);
 
-/* Write the given buffer out to the control pipe.  */
-static int mxu1_send_ctrl_data_urb(struct usb_serial *serial,
-				   u8 request,
-				   u16 value, u16 index,
-				   void *data, size_t size)
-{
-	int status;
+/* Prepared download images, one slot per supported model */
+struct mxu1_fw_image {
+	u16 model;
+	u8 *data;
+	int size;
+};
 
-	status = usb_control_msg(serial->dev,
-				 usb_sndctrlpipe(serial->dev, 0),
-				 request,
-				 (USB_DIR_OUT | USB_TYPE_VENDOR |
-				  USB_RECIP_DEVICE), value, index,
-				 data, size,
-				 USB_CTRL_SET_TIMEOUT);
-	if (status < 0) {
-		dev_err(&serial->interface->dev,
-			"%s - usb_control_msg failed: %d\n",
-			__func__, status);
-		return status;
-	}
+static DEFINE_MUTEX(mxu1_fw_lock);
+static struct mxu1_fw_image mxu1_fw_cache[ARRAY_SIZE(mxu1_idtable) - 1];
 
-	if (status != size) {
-		dev_err(&serial->interface->dev,
-			"%s - short write (%d / %zd)\n",
-			__func__, status, size);
-		return -EIO;
-	}
+/*
+ * Firmware download of a device probed without firmware.  Probe only
+ * starts it, so that the hub thread can go on enumerating other devices
+ * while the firmware is looked up, downloaded and the device reset.
+ */
+struct mxu1_fw_load {
+	struct work_struct work;
+	struct usb_device *dev;
+	u16 model;
+	u8 endpoint;
+	const struct mxu1_fw_image *image;
+	ktime_t start;
+};
 
-	return 0;
-}
+/* Runs the downloads; drained on module unload */
+static struct workqueue_struct *mxu1_fw_wq;
 
-/* Send a vendor request without any data */
-static int mxu1_send_ctrl_urb(struct usb_serial *serial,
-			      u8 request, u16 value, u16 index)
+/* Directory of the per port statistics files */
+static struct dentry *mxu1_debugfs;
+
+/* Return a request to the pool; may be called from completion context */
+static void mxu1_ctrl_free(struct mxu1_ctrl_req *req)
 {
-	return mxu1_send_ctrl_data_urb(serial, request, value, index,
-				       NULL, 0);
+	struct mxu1_device *mxdev = req->mxdev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mxdev->ctrl_lock, flags);
+	list_add_tail(&req->list, &mxdev->ctrl_free);
+	spin_unlock_irqrestore(&mxdev->ctrl_lock, flags);
+
+	wake_up(&mxdev->ctrl_wait);
 }
 
-static int mxu1_download_firmware(struct usb_serial *serial,
-				  const struct firmware *fw_p,
-				  struct usb_endpoint_descriptor *endpoint)
+static struct mxu1_ctrl_req *mxu1_ctrl_try_get(struct mxu1_device *mxdev)
 {
-	int status = 0;
-	int buffer_size;
-	int pos;
-	int len;
-	int done;
-	u8 cs = 0;
-	u8 *buffer;
-	struct usb_device *dev = serial->dev;
-	struct mxu1_firmware_header *header;
-	unsigned int pipe;
+	struct mxu1_ctrl_req *req = NULL;
+	unsigned long flags;
 
-	pipe = usb_sndbulkpipe(dev, endpoint->bEndpointAddress);
+	spin_lock_irqsave(&mxdev->ctrl_lock, flags);
+	if (!list_empty(&mxdev->ctrl_free)) {
+		req = list_first_entry(&mxdev->ctrl_free,
+				       struct mxu1_ctrl_req, list);
+		list_del(&req->list);
+	}
+	spin_unlock_irqrestore(&mxdev->ctrl_lock, flags);
 
-	buffer_size = fw_p->size + sizeof(*header);
-	buffer = kmalloc(buffer_size, GFP_KERNEL);
-	if (!buffer)
-		return -ENOMEM;
+	return req;
+}
 
-	memcpy(buffer, fw_p->data, fw_p->size);
-	memset(buffer + fw_p->size, 0xff, buffer_size - fw_p->size);
+static void mxu1_ctrl_pool_free(struct mxu1_device *mxdev)
+{
+	struct mxu1_ctrl_req *req;
+	int i;
 
-	for (pos = sizeof(*header); pos < buffer_size; pos++)
-		cs = (u8)(cs + buffer[pos]);
+	for (i = 0; i < MXU1_CTRL_POOL_SIZE; i++) {
+		req = &mxdev->ctrl_pool[i];
+		usb_free_urb(req->urb);
+		kfree(req->data);
+		kfree(req->setup);
+	}
+}
 
-	header = (struct mxu1_firmware_header *)buffer;
-	header->wLength = cpu_to_le16(buffer_size - sizeof(*header));
-	header->bCheckSum = cs;
+static int mxu1_ctrl_pool_alloc(struct mxu1_device *mxdev)
+{
+	struct mxu1_ctrl_req *req;
+	int i;
 
-	dev_dbg(&dev->dev, "%s - downloading firmware\n", __func__);
+	INIT_LIST_HEAD(&mxdev->ctrl_free);
+	init_waitqueue_head(&mxdev->ctrl_wait);
 
-	for (pos = 0; pos < buffer_size; pos += done) {
-		len = min(buffer_size - pos, MXU1_DOWNLOAD_MAX_PACKET_SIZE);
+	for (i = 0; i < MXU1_CTRL_POOL_SIZE; i++) {
+		req = &mxdev->ctrl_pool[i];
 
-		status = usb_bulk_msg(dev, pipe, buffer + pos, len, &done,
-				MXU1_DOWNLOAD_TIMEOUT);
-		if (status)
-			break;
+		req->mxdev = mxdev;
+		req->urb = usb_alloc_urb(0, GFP_KERNEL);
+		req->setup = kmalloc(sizeof(*req->setup), GFP_KERNEL);
+		req->data = kmalloc(MXU1_CTRL_MAX_DATA, GFP_KERNEL);
+		if (!req->urb || !req->setup || !req->data) {
+			mxu1_ctrl_pool_free(mxdev);
+			return -ENOMEM;
+		}
+
+		init_completion(&req->done);
+		list_add_tail(&req->list, &mxdev->ctrl_free);
 	}
 
-	kfree(buffer);
+	return 0;
+}
+
+/* The device or its host controller is gone; retrying is pointless */
+static bool mxu1_ctrl_gone(int status)
+{
+	return status == -ENODEV || status == -ESHUTDOWN;
+}
 
-	if (status) {
-		dev_err(&dev->dev, "failed to download firmware: %d\n", status);
-		return status;
+static void mxu1_ctrl_finish(struct mxu1_ctrl_req *req)
+{
+	struct usb_serial *serial = req->mxdev->serial;
+
+	if (mxu1_ctrl_gone(req->status)) {
+		dev_dbg(&serial->interface->dev,
+			"%s - request 0x%02X dropped: %d\n",
+			__func__, req->setup->bRequest, req->status);
+	} else if (req->status && req->quiet) {
+		dev_dbg(&serial->interface->dev,
+			"%s - request 0x%02X failed: %d\n",
+			__func__, req->setup->bRequest, req->status);
+	} else if (req->status) {
+		dev_err(&serial->interface->dev,
+			"%s - request 0x%02X failed: %d\n",
+			__func__, req->setup->bRequest, req->status);
 	}
 
-	msleep_interruptible(100);
-	usb_reset_device(dev);
+	if (req->sync) {
+		complete(&req->done);
+		return;
+	}
 
-	dev_dbg(&dev->dev, "%s - download successful\n", __func__);
+	if (req->complete)
+		req->complete(req->context, req->status);
 
-	return 0;
+	mxu1_ctrl_free(req);
 }
 
-static void mxu1_release(struct usb_serial *serial)
+static void mxu1_ctrl_finish_list(struct list_head *list)
 {
-	struct mxu1_device *mxdev;
+	struct mxu1_ctrl_req *req, *tmp;
 
-	mxdev = usb_get_serial_data(serial);
-	kfree(mxdev);
+	list_for_each_entry_safe(req, tmp, list, list) {
+		list_del(&req->list);
+		mxu1_ctrl_finish(req);
+	}
 }
 
-static int mxu1_probe(struct usb_serial *serial, const struct usb_device_id *id)
+/*
+ * Account for a finished request: timeouts point at a slow or wedged
+ * device, drops at one that is gone.  Called with ctrl_lock held.
+ */
+static void mxu1_ctrl_account(struct mxu1_device *mxdev,
+			      struct mxu1_ctrl_req *req, bool issued)
 {
-	struct usb_host_interface *cur_altsetting;
-	char fw_name[32];
-	const struct firmware *fw_p = NULL;
-	struct usb_device *dev = serial->dev;
-	u16 model;
-	int err;
-	struct usb_endpoint_descriptor *endpoint, *interrupt_in, *bulk_out;
-	int i;
-
-	dev_dbg(&serial->interface->dev, "%s - product 0x%04X, num configurations %d, configuration value %d\n",
-		__func__, le16_to_cpu(dev->descriptor.idProduct),
-		dev->descriptor.bNumConfigurations,
-		dev->actconfig->desc.bConfigurationValue);
+	s64 us;
 
-	cur_altsetting = serial->interface->cur_altsetting;
-	interrupt_in = NULL;
-	bulk_out = NULL;
+	mxdev->ctrl_requests++;
 
-	for (i = 0; i < cur_altsetting->desc.bNumEndpoints; i++) {
-		endpoint = &cur_altsetting->endpoint[i].desc;
-		if (usb_endpoint_is_bulk_out(endpoint)) {
-			dev_dbg(&serial->interface->dev,
-				"found bulk out on endpoint %d\n", i);
-			bulk_out = endpoint;
-		}
+	if (req->status && req->batch)
+		req->batch->failed = true;
 
-		if (usb_endpoint_is_int_in(endpoint)) {
-			dev_dbg(&serial->interface->dev,
-				"found interrupt in on endpoint %d\n", i);
-			interrupt_in = endpoint;
-		}
+	if (issued) {
+		mxdev->ctrl_issued++;
+		us = ktime_us_delta(ktime_get(), req->start);
+		mxdev->ctrl_total_us += us;
+		if (us > mxdev->ctrl_max_us)
+			mxdev->ctrl_max_us = us;
 	}
 
-	/* if we have only 1 bulk out endpoint, download firmware */
-	if (bulk_out && (cur_altsetting->desc.bNumEndpoints == 1)) {
+	if (req->status == -ETIMEDOUT) {
+		mxdev->ctrl_timeouts++;
+		mxdev->ctrl_last_timeout = req->setup->bRequest;
+	} else if (mxu1_ctrl_gone(req->status) ||
+		   req->status == -ECANCELED) {
+		mxdev->ctrl_dropped++;
+	} else if (req->status) {
+		mxdev->ctrl_errors++;
+	}
+}
 
-		model = le16_to_cpu(dev->descriptor.idProduct);
-		snprintf(fw_name,
-			 sizeof(fw_name),
-			 "moxa/moxa-%04x.fw",
-			 model);
-
-		err = request_firmware(&fw_p, fw_name, &serial->interface->dev);
-		if (err) {
-			dev_err(&serial->interface->dev, "failed to request firmware: %d\n",
-				err);
-			return -ENODEV;
+/*
+ * Issue the next queued request unless one is already on the wire.
+ * Requests that cannot be submitted are moved to failed, to be finished
+ * once ctrl_lock is dropped.  Once the device is known to be gone every
+ * queued request fails at once instead of waiting for its turn.
+ * Called with ctrl_lock held.
+ */
+static void mxu1_ctrl_start(struct mxu1_device *mxdev,
+			    struct list_head *failed)
+{
+	struct mxu1_ctrl_req *req;
+
+	while (!mxdev->ctrl_active && !list_empty(&mxdev->ctrl_queue)) {
+		req = list_first_entry(&mxdev->ctrl_queue,
+				       struct mxu1_ctrl_req, list);
+		list_del(&req->list);
+
+		if (mxdev->ctrl_dead || mxdev->serial->disconnected) {
+			req->status = -ENODEV;
+			mxu1_ctrl_account(mxdev, req, false);
+			list_add_tail(&req->list, failed);
+			continue;
 		}
 
-		err = mxu1_download_firmware(serial, fw_p, bulk_out);
-		if (err)
-			goto err_release_firmware;
+		/* an earlier request of the same batch failed */
+		if (req->batch && req->batch->failed) {
+			req->status = -ECANCELED;
+			req->quiet = true;
+			mxu1_ctrl_account(mxdev, req, false);
+			list_add_tail(&req->list, failed);
+			continue;
+		}
 
-		/* device is being reset */
-		err = -ENODEV;
-		goto err_release_firmware;
+		req->start = ktime_get();
+		req->status = usb_submit_urb(req->urb, GFP_ATOMIC);
+		if (req->status) {
+			if (mxu1_ctrl_gone(req->status))
+				mxdev->ctrl_dead = true;
+			mxu1_ctrl_account(mxdev, req, false);
+			list_add_tail(&req->list, failed);
+			continue;
+		}
 
-	} else if (!interrupt_in) {
-		/* firmware is already loaded but there is
-		 * no interrupt in endpoint available
-		 */
-		dev_err(&serial->interface->dev, "no interrupt endpoint\n");
-		return -ENODEV;
+		mxdev->ctrl_active = req;
+		mxdev->ctrl_deadline = jiffies + msecs_to_jiffies(req->timeout);
+		mod_timer(&mxdev->ctrl_timer, mxdev->ctrl_deadline);
 	}
+}
 
-	return 0;
+static void mxu1_ctrl_callback(struct urb *urb)
+{
+	struct mxu1_ctrl_req *req = urb->context;
+	struct mxu1_device *mxdev = req->mxdev;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	req->status = urb->status;
+	if (req->timed_out) {
+		req->status = -ETIMEDOUT;
+	} else if (!req->status && urb->actual_length != req->size) {
+		if (!req->quiet) {
+			dev_err(&mxdev->serial->interface->dev,
+				"%s - short transfer (%d / %zd)\n",
+				__func__, urb->actual_length, req->size);
+		}
+		req->status = -EIO;
+	}
 
-err_release_firmware:
-	release_firmware(fw_p);
-	return err;
+	spin_lock_irqsave(&mxdev->ctrl_lock, flags);
+	if (mxu1_ctrl_gone(req->status))
+		mxdev->ctrl_dead = true;
+	else if (req->status && mxdev->ctrl_dead)
+		req->status = -ENODEV;	/* killed by mxu1_ctrl_flush() */
+	mxu1_ctrl_account(mxdev, req, true);
+	del_timer(&mxdev->ctrl_timer);
+	mxdev->ctrl_active = NULL;
+	list_add_tail(&req->list, &done);
+	mxu1_ctrl_start(mxdev, &done);
+	spin_unlock_irqrestore(&mxdev->ctrl_lock, flags);
+
+	mxu1_ctrl_finish_list(&done);
 }
 
-static int mxu1_port_probe(struct usb_serial_port *port)
+static void mxu1_ctrl_timeout(unsigned long data)
 {
-	struct mxu1_port *mxport;
-	struct mxu1_device *mxdev;
-
-	mxport = kzalloc(sizeof(struct mxu1_port), GFP_KERNEL);
-	if (!mxport)
-		return -ENOMEM;
+	struct mxu1_device *mxdev = (struct mxu1_device *)data;
+	struct urb *urb = NULL;
+	unsigned long flags;
 
-	spin_lock_init(&mxport->spinlock);
-	mutex_init(&mxport->mutex);
+	spin_lock_irqsave(&mxdev->ctrl_lock, flags);
+	/* the request may have completed and a new one started meanwhile */
+	if (mxdev->ctrl_active &&
+	    time_after_eq(jiffies, mxdev->ctrl_deadline)) {
+		mxdev->ctrl_active->timed_out = true;
+		urb = usb_get_urb(mxdev->ctrl_active->urb);
+	}
+	spin_unlock_irqrestore(&mxdev->ctrl_lock, flags);
 
-	mxdev = usb_get_serial_data(port->serial);
+	/* the completion handler may run before usb_unlink_urb returns */
+	if (urb) {
+		usb_unlink_urb(urb);
+		usb_put_urb(urb);
+	}
+}
 
-	switch (mxdev->mxd_model) {
-	case MXU1_1110_PRODUCT_ID:
-	case MXU1_1150_PRODUCT_ID:
-	case MXU1_1151_PRODUCT_ID:
-		mxport->uart_mode = MXU1_UART_232;
-		break;
-	case MXU1_1130_PRODUCT_ID:
-	case MXU1_1131_PRODUCT_ID:
-		mxport->uart_mode = MXU1_UART_485_RECEIVER_DISABLED;
-		break;
+/*
+ * The device is gone: fail everything still queued, cancel the request
+ * on the wire and refuse any further requests.  Callers blocked on a
+ * request to a vanished device return right away instead of waiting
+ * for the control timeout.
+ */
+static void mxu1_ctrl_flush(struct mxu1_device *mxdev)
+{
+	struct mxu1_ctrl_req *req, *tmp;
+	struct urb *urb = NULL;
+	unsigned long flags;
+	LIST_HEAD(failed);
+
+	spin_lock_irqsave(&mxdev->ctrl_lock, flags);
+	mxdev->ctrl_dead = true;
+	list_for_each_entry_safe(req, tmp, &mxdev->ctrl_queue, list) {
+		req->status = -ENODEV;
+		mxu1_ctrl_account(mxdev, req, false);
+		list_move_tail(&req->list, &failed);
 	}
+	if (mxdev->ctrl_active)
+		urb = usb_get_urb(mxdev->ctrl_active->urb);
+	spin_unlock_irqrestore(&mxdev->ctrl_lock, flags);
 
-	usb_set_serial_port_data(port, mxport);
+	mxu1_ctrl_finish_list(&failed);
 
-	port->port.closing_wait =
-			msecs_to_jiffies(MXU1_DEFAULT_CLOSING_WAIT * 10);
-	port->port.drain_delay = 1;
+	if (urb) {
+		usb_kill_urb(urb);
+		usb_put_urb(urb);
+	}
 
-	return 0;
+	del_timer_sync(&mxdev->ctrl_timer);
 }
 
-static int mxu1_port_remove(struct usb_serial_port *port)
+/* True once the device was unplugged or its controller went away */
+static bool mxu1_device_gone(struct usb_serial *serial)
 {
-	struct mxu1_port *mxport;
+	struct mxu1_device *mxdev = usb_get_serial_data(serial);
 
-	mxport = usb_get_serial_port_data(port);
-	kfree(mxport);
-
-	return 0;
+	return serial->disconnected || READ_ONCE(mxdev->ctrl_dead);
 }
 
-static int mxu1_startup(struct usb_serial *serial)
+/* Timeout of a vendor request, in ms */
+static unsigned int mxu1_ctrl_budget(u8 request)
 {
-	struct mxu1_device *mxdev;
-
-	/* create device structure */
-	mxdev = kzalloc(sizeof(struct mxu1_device), GFP_KERNEL);
-	if (!mxdev)
-		return -ENOMEM;
-
-	usb_set_serial_data(serial, mxdev);
-
-	return 0;
+	unsigned int timeout = READ_ONCE(ctrl_timeout);
+
+	if (timeout)
+		return timeout;
+
+	switch (request) {
+	case MXU1_GET_VERSION:
+	case MXU1_GET_PORT_STATUS:
+	case MXU1_GET_OUTQUEUE:
+	case MXU1_PURGE_PORT:
+	case MXU1_WRITE_DATA:
+		return MXU1_CTRL_TIMEOUT_SHORT;
+	case MXU1_SET_CONFIG:
+	case MXU1_OPEN_PORT:
+	case MXU1_CLOSE_PORT:
+	case MXU1_START_PORT:
+	case MXU1_STOP_PORT:
+		return MXU1_CTRL_TIMEOUT_PORT;
+	default:
+		return USB_CTRL_SET_TIMEOUT;
+	}
 }
 
-static int mxu1_write_byte(struct usb_serial_port *port, u32 addr,
-			   u8 mask, u8 byte)
+/*
+ * Take a request from the pool and set it up.  Sleeps until a request is
+ * returned if the pool is exhausted.
+ */
+static struct mxu1_ctrl_req *mxu1_ctrl_alloc(struct usb_serial *serial,
+					      u8 request_type, u8 request,
+					      u16 value, u16 index,
+					      size_t size)
 {
-	int status;
-	size_t size;
-	struct mxu1_write_data_bytes *data;
+	struct mxu1_device *mxdev = usb_get_serial_data(serial);
+	struct usb_device *dev = serial->dev;
+	struct mxu1_ctrl_req *req;
+	unsigned int pipe;
 
-	dev_dbg(&port->dev, "%s - addr 0x%08X, mask 0x%02X, byte 0x%02X\n",
-		__func__, addr, mask, byte);
+	if (WARN_ON(size > MXU1_CTRL_MAX_DATA))
+		return NULL;
+
+	wait_event(mxdev->ctrl_wait,
+		   (req = mxu1_ctrl_try_get(mxdev)) != NULL);
+
+	req->size = size;
+	req->timeout = mxu1_ctrl_budget(request);
+	req->timed_out = false;
+	req->quiet = false;
+	req->status = 0;
+	req->sync = false;
+	req->complete = NULL;
+	req->context = NULL;
+	req->batch = NULL;
+	reinit_completion(&req->done);
+
+	req->setup->bRequestType = request_type;
+	req->setup->bRequest = request;
+	req->setup->wValue = cpu_to_le16(value);
+	req->setup->wIndex = cpu_to_le16(index);
+	req->setup->wLength = cpu_to_le16(size);
+
+	if (request_type & USB_DIR_IN)
+		pipe = usb_rcvctrlpipe(dev, 0);
+	else
+		pipe = usb_sndctrlpipe(dev, 0);
 
-	size = sizeof(struct mxu1_write_data_bytes) + 2;
-	data = kzalloc(size, GFP_KERNEL);
-	if (!data)
-		return -ENOMEM;
+	usb_fill_control_urb(req->urb, dev, pipe,
+			     (unsigned char *)req->setup, req->data, size,
+			     mxu1_ctrl_callback, req);
 
-	data->bAddrType = MXU1_RW_DATA_ADDR_XDATA;
-	data->bDataType = MXU1_RW_DATA_BYTE;
-	data->bDataCounter = 1;
-	data->wBaseAddrHi = cpu_to_be16(addr >> 16);
-	data->wBaseAddrLo = cpu_to_be16(addr);
-	data->bData[0] = mask;
-	data->bData[1] = byte;
+	return req;
+}
 
-	status = mxu1_send_ctrl_data_urb(port->serial, MXU1_WRITE_DATA, 0,
-					 MXU1_RAM_PORT, data, size);
-	if (status < 0)
-		dev_err(&port->dev, "%s - failed: %d\n", __func__, status);
+static void mxu1_ctrl_queue(struct mxu1_ctrl_req *req)
+{
+	struct mxu1_device *mxdev = req->mxdev;
+	unsigned long flags;
+	LIST_HEAD(failed);
 
-	kfree(data);
+	spin_lock_irqsave(&mxdev->ctrl_lock, flags);
+	list_add_tail(&req->list, &mxdev->ctrl_queue);
+	mxu1_ctrl_start(mxdev, &failed);
+	spin_unlock_irqrestore(&mxdev->ctrl_lock, flags);
 
-	return status;
+	mxu1_ctrl_finish_list(&failed);
 }
 
-static int mxu1_set_mcr(struct usb_serial_port *port, unsigned int mcr)
+/* Queue a request and wait for it; the caller still owns req afterwards */
+static int mxu1_ctrl_wait(struct mxu1_ctrl_req *req)
 {
-	int status;
+	req->sync = true;
+	mxu1_ctrl_queue(req);
+	wait_for_completion(&req->done);
 
-	status = mxu1_write_byte(port,
-				 MXU1_UART_BASE_ADDR + MXU1_UART_OFFSET_MCR,
+	return req->status;
+}
+
+/* Write the given buffer out to the control pipe.  */
+static int mxu1_send_ctrl_data_urb(struct usb_serial *serial,
+				   u8 request,
+				   u16 value, u16 index,
+				   void *data, size_t size)
+{
+	struct mxu1_ctrl_req *req;
+	int status;
+
+	req = mxu1_ctrl_alloc(serial,
+			      (USB_DIR_OUT | USB_TYPE_VENDOR |
+			       USB_RECIP_DEVICE),
+			      request, value, index, size);
+	if (!req)
+		return -ENOMEM;
+
+	if (size)
+		memcpy(req->data, data, size);
+
+	status = mxu1_ctrl_wait(req);
+	mxu1_ctrl_free(req);
+
+	return status;
+}
+
+/*
+ * Queue the given buffer for the control pipe and return immediately.
+ * complete, if not NULL, is called from the urb completion with the
+ * final status; failures are logged either way.
+ */
+static int mxu1_send_ctrl_data_urb_async(struct usb_serial *serial,
+					 u8 request,
+					 u16 value, u16 index,
+					 const void *data, size_t size,
+					 mxu1_ctrl_complete_t complete,
+					 void *context)
+{
+	struct mxu1_ctrl_req *req;
+
+	req = mxu1_ctrl_alloc(serial,
+			      (USB_DIR_OUT | USB_TYPE_VENDOR |
+			       USB_RECIP_DEVICE),
+			      request, value, index, size);
+	if (!req)
+		return -ENOMEM;
+
+	if (size)
+		memcpy(req->data, data, size);
+
+	req->complete = complete;
+	req->context = context;
+	mxu1_ctrl_queue(req);
+
+	return 0;
+}
+
+/* Send a vendor request without any data */
+static int mxu1_send_ctrl_urb(struct usb_serial *serial,
+			      u8 request, u16 value, u16 index)
+{
+	return mxu1_send_ctrl_data_urb(serial, request, value, index,
+				       NULL, 0);
+}
+
+/* Read the reply to a vendor request from the control pipe. */
+static int mxu1_recv_ctrl_urb(struct usb_serial *serial,
+			      u8 request,
+			      u16 value, u16 index,
+			      void *data, size_t size)
+{
+	struct mxu1_ctrl_req *req;
+	int status;
+
+	req = mxu1_ctrl_alloc(serial,
+			      (USB_DIR_IN | USB_TYPE_VENDOR |
+			       USB_RECIP_DEVICE),
+			      request, value, index, size);
+	if (!req)
+		return -ENOMEM;
+
+	status = mxu1_ctrl_wait(req);
+	if (!status)
+		memcpy(data, req->data, size);
+
+	mxu1_ctrl_free(req);
+
+	return status;
+}
+
+static void mxu1_batch_init(struct mxu1_ctrl_batch *batch)
+{
+	atomic_set(&batch->pending, 1);
+	batch->status = 0;
+	batch->failed = false;
+	init_completion(&batch->done);
+}
+
+/* Requests complete one at a time, so status needs no locking */
+static void mxu1_batch_complete(void *context, int status)
+{
+	struct mxu1_ctrl_batch *batch = context;
+
+	if (status && !batch->status)
+		batch->status = status;
+
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/* Queue a vendor request without data as part of batch */
+static void mxu1_batch_send(struct usb_serial *serial,
+			    u8 request, u16 value, u16 index,
+			    struct mxu1_ctrl_batch *batch)
+{
+	struct mxu1_ctrl_req *req;
+
+	atomic_inc(&batch->pending);
+
+	req = mxu1_ctrl_alloc(serial,
+			      (USB_DIR_OUT | USB_TYPE_VENDOR |
+			       USB_RECIP_DEVICE),
+			      request, value, index, 0);
+	if (!req) {
+		mxu1_batch_complete(batch, -ENOMEM);
+		return;
+	}
+
+	req->complete = mxu1_batch_complete;
+	req->context = batch;
+	req->batch = batch;
+	mxu1_ctrl_queue(req);
+}
+
+/* Wait for every request of batch; returns the first error */
+static int mxu1_batch_wait(struct mxu1_ctrl_batch *batch)
+{
+	mxu1_batch_complete(batch, 0);
+	wait_for_completion(&batch->done);
+
+	return batch->status;
+}
+
+static DEFINE_SPINLOCK(mxu1_reenum_lock);
+static struct mxu1_reenum {
+	int busnum;
+	char devpath[16];
+	ktime_t reset;
+} mxu1_reenum[MXU1_REENUM_SLOTS];
+static unsigned int mxu1_reenum_next;
+
+static void mxu1_reenum_mark(struct usb_device *dev)
+{
+	struct mxu1_reenum *slot;
+
+	spin_lock(&mxu1_reenum_lock);
+	slot = &mxu1_reenum[mxu1_reenum_next++ % MXU1_REENUM_SLOTS];
+	slot->busnum = dev->bus->busnum;
+	strlcpy(slot->devpath, dev->devpath, sizeof(slot->devpath));
+	slot->reset = ktime_get();
+	spin_unlock(&mxu1_reenum_lock);
+}
+
+/* Report how long a device took to come back with its firmware running */
+static void mxu1_reenum_check(struct usb_device *dev)
+{
+	struct mxu1_reenum *slot;
+	s64 ms = -1;
+	int i;
+
+	spin_lock(&mxu1_reenum_lock);
+	for (i = 0; i < MXU1_REENUM_SLOTS; i++) {
+		slot = &mxu1_reenum[i];
+		if (slot->busnum != dev->bus->busnum ||
+		    strcmp(slot->devpath, dev->devpath))
+			continue;
+
+		ms = ktime_ms_delta(ktime_get(), slot->reset);
+		slot->busnum = 0;
+		break;
+	}
+	spin_unlock(&mxu1_reenum_lock);
+
+	if (ms >= 0)
+		dev_dbg(&dev->dev, "%s - re-enumerated in %lld ms\n",
+			__func__, ms);
+}
+
+static void mxu1_download_callback(struct urb *urb)
+{
+	int *error = urb->context;
+
+	if (urb->status)
+		cmpxchg(error, 0, urb->status);
+}
+
+/* Queue the whole image on the bulk-out pipe and wait for it */
+static int mxu1_download_image(struct usb_device *dev, unsigned int pipe,
+			       u8 *buffer, int size)
+{
+	struct usb_anchor anchor;
+	struct urb *urb;
+	int maxp = usb_maxpacket(dev, pipe, 1);
+	int chunk;
+	int error = 0;
+	int status = 0;
+	int count = 0;
+	int pos;
+	int len;
+
+	if (!maxp)
+		maxp = MXU1_DOWNLOAD_MAX_PACKET_SIZE;
+	chunk = max(rounddown(MXU1_DOWNLOAD_CHUNK_SIZE, maxp), maxp);
+
+	init_usb_anchor(&anchor);
+
+	for (pos = 0; pos < size; pos += len) {
+		len = min(size - pos, chunk);
+
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb) {
+			status = -ENOMEM;
+			break;
+		}
+
+		usb_fill_bulk_urb(urb, dev, pipe, buffer + pos, len,
+				  mxu1_download_callback, &error);
+		usb_anchor_urb(urb, &anchor);
+
+		status = usb_submit_urb(urb, GFP_KERNEL);
+		if (status)
+			usb_unanchor_urb(urb);
+		usb_free_urb(urb);
+		if (status)
+			break;
+
+		count++;
+	}
+
+	if (!status && !usb_wait_anchor_empty_timeout(&anchor,
+					MXU1_DOWNLOAD_TIMEOUT * count))
+		status = -ETIMEDOUT;
+
+	if (status)
+		usb_kill_anchored_urbs(&anchor);
+	else
+		status = error;
+
+	return status;
+}
+
+/*
+ * Build the padded download image with its header filled in.  Images
+ * packed by firmware/mxu1_fwtool already carry the header and are only
+ * copied, since firmware data cannot be used for DMA; the boot loader
+ * checks bCheckSum itself.
+ */
+static int mxu1_prepare_firmware(const struct firmware *fw_p,
+				 struct mxu1_fw_image *image)
+{
+	int buffer_size;
+	int pos;
+	u8 cs = 0;
+	u8 *buffer;
+	struct mxu1_firmware_header *header;
+	const struct mxu1_firmware_header *packed;
+
+	packed = (const struct mxu1_firmware_header *)fw_p->data;
+	if (fw_p->size > sizeof(*packed) &&
+	    le16_to_cpu(packed->wLength) == fw_p->size - sizeof(*packed)) {
+		image->data = kmemdup(fw_p->data, fw_p->size, GFP_KERNEL);
+		if (!image->data)
+			return -ENOMEM;
+
+		image->size = fw_p->size;
+
+		return 0;
+	}
+
+	buffer_size = fw_p->size + sizeof(*header);
+	buffer = kmalloc(buffer_size, GFP_KERNEL);
+	if (!buffer)
+		return -ENOMEM;
+
+	memcpy(buffer, fw_p->data, fw_p->size);
+	memset(buffer + fw_p->size, 0xff, buffer_size - fw_p->size);
+
+	for (pos = sizeof(*header); pos < buffer_size; pos++)
+		cs = (u8)(cs + buffer[pos]);
+
+	header = (struct mxu1_firmware_header *)buffer;
+	header->wLength = cpu_to_le16(buffer_size - sizeof(*header));
+	header->bCheckSum = cs;
+
+	image->data = buffer;
+	image->size = buffer_size;
+
+	return 0;
+}
+
+/* Look up the cached download image of model; NULL if not loaded yet */
+static const struct mxu1_fw_image *mxu1_find_firmware(u16 model)
+{
+	const struct mxu1_fw_image *image = NULL;
+	int i;
+
+	mutex_lock(&mxu1_fw_lock);
+	for (i = 0; i < ARRAY_SIZE(mxu1_fw_cache); i++) {
+		if (mxu1_fw_cache[i].model == model) {
+			image = &mxu1_fw_cache[i];
+			break;
+		}
+	}
+	mutex_unlock(&mxu1_fw_lock);
+
+	return image;
+}
+
+/*
+ * The cache slot of model, or a free one if model is not cached yet.
+ * Called with mxu1_fw_lock held.
+ */
+static struct mxu1_fw_image *mxu1_fw_slot(u16 model)
+{
+	struct mxu1_fw_image *image = NULL;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mxu1_fw_cache); i++) {
+		if (mxu1_fw_cache[i].model == model)
+			return &mxu1_fw_cache[i];
+		if (!image && !mxu1_fw_cache[i].model)
+			image = &mxu1_fw_cache[i];
+	}
+
+	return image;
+}
+
+/*
+ * Prepare the loaded firmware of model and add it to the cache, unless
+ * a concurrent load already did.  The image stays valid until the module
+ * is unloaded.
+ */
+static const struct mxu1_fw_image *mxu1_cache_firmware(u16 model,
+					const struct firmware *fw_p)
+{
+	struct mxu1_fw_image *image;
+
+	mutex_lock(&mxu1_fw_lock);
+
+	image = mxu1_fw_slot(model);
+	if (!image || image->model)
+		goto out;
+
+	if (mxu1_prepare_firmware(fw_p, image)) {
+		image = NULL;
+		goto out;
+	}
+
+	image->model = model;
+out:
+	mutex_unlock(&mxu1_fw_lock);
+
+	return image;
+}
+
+#ifdef MXU1_BUILTIN_FIRMWARE
+/* Download images linked into the module, headers computed at build time */
+struct mxu1_fw_builtin {
+	u16 model;
+	const u8 *data;
+	size_t size;
+};
+
+#include "firmware/mxu11x0_fw_builtin.h"
+
+/*
+ * Add the built-in image of model to the cache.  It is copied, as module
+ * data cannot be used for DMA, but needs no padding or checksum pass.
+ */
+static const struct mxu1_fw_image *mxu1_builtin_firmware(u16 model)
+{
+	const struct mxu1_fw_builtin *fw = NULL;
+	struct mxu1_fw_image *image;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mxu1_fw_builtin); i++) {
+		if (mxu1_fw_builtin[i].model == model) {
+			fw = &mxu1_fw_builtin[i];
+			break;
+		}
+	}
+
+	if (!fw)
+		return NULL;
+
+	mutex_lock(&mxu1_fw_lock);
+
+	image = mxu1_fw_slot(model);
+	if (!image || image->model)
+		goto out;
+
+	image->data = kmemdup(fw->data, fw->size, GFP_KERNEL);
+	if (!image->data) {
+		image = NULL;
+		goto out;
+	}
+
+	image->size = fw->size;
+	image->model = model;
+out:
+	mutex_unlock(&mxu1_fw_lock);
+
+	return image;
+}
+#else
+static const struct mxu1_fw_image *mxu1_builtin_firmware(u16 model)
+{
+	return NULL;
+}
+#endif
+
+static void mxu1_free_firmware(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mxu1_fw_cache); i++) {
+		kfree(mxu1_fw_cache[i].data);
+		mxu1_fw_cache[i].data = NULL;
+		mxu1_fw_cache[i].model = 0;
+	}
+}
+
+static int mxu1_download_firmware(struct usb_device *dev,
+				  const struct mxu1_fw_image *image,
+				  u8 endpoint)
+{
+	int status = 0;
+	unsigned int pipe;
+	ktime_t start, transfer, settle;
+
+	pipe = usb_sndbulkpipe(dev, endpoint);
+
+	dev_dbg(&dev->dev, "%s - downloading firmware\n", __func__);
+
+	/*
+	 * The cached image is shared by every device of the model and only
+	 * ever read, so concurrent downloads may map it at the same time.
+	 */
+	start = ktime_get();
+	status = mxu1_download_image(dev, pipe, image->data, image->size);
+	transfer = ktime_get();
+
+	if (status) {
+		dev_err(&dev->dev, "failed to download firmware: %d\n", status);
+		return status;
+	}
+
+	/*
+	 * The boot loader reports nothing while it checks and starts the
+	 * image, so give it the full time before the reset.
+	 */
+	msleep(MXU1_DOWNLOAD_SETTLE);
+	settle = ktime_get();
+
+	/* the interface is unbound by now, lock the device only */
+	mxu1_reenum_mark(dev);
+	status = usb_lock_device_for_reset(dev, NULL);
+	if (status) {
+		dev_err(&dev->dev, "cannot lock device for reset: %d\n",
+			status);
+		return status;
+	}
+
+	/*
+	 * The running firmware has new descriptors, so the reset ends in
+	 * a re-enumeration, which usb_reset_device reports as -ENODEV.
+	 */
+	status = usb_reset_device(dev);
+	usb_unlock_device(dev);
+	if (status && status != -ENODEV) {
+		dev_err(&dev->dev, "failed to reset device: %d\n", status);
+		return status;
+	}
+
+	dev_dbg(&dev->dev, "%s - download successful: transfer %lld us, settle %lld us, reset %lld us\n",
+		__func__, ktime_us_delta(transfer, start),
+		ktime_us_delta(settle, transfer),
+		ktime_us_delta(ktime_get(), settle));
+
+	return 0;
+}
+
+static void mxu1_disconnect(struct usb_serial *serial)
+{
+	mxu1_ctrl_flush(usb_get_serial_data(serial));
+}
+
+/*
+ * Ask the device for its firmware version; only a running firmware
+ * answers vendor requests, so no answer is not an error.
+ */
+static int mxu1_get_version(struct usb_serial *serial,
+			    struct mxu1_fw_version *version)
+{
+	struct mxu1_ctrl_req *req;
+	int status;
+
+	req = mxu1_ctrl_alloc(serial,
+			      (USB_DIR_IN | USB_TYPE_VENDOR |
+			       USB_RECIP_DEVICE),
+			      MXU1_GET_VERSION, 0, 0, sizeof(*version));
+	if (!req)
+		return -ENOMEM;
+
+	req->quiet = true;
+
+	status = mxu1_ctrl_wait(req);
+	if (!status)
+		memcpy(version, req->data, sizeof(*version));
+
+	mxu1_ctrl_free(req);
+
+	return status;
+}
+
+static void mxu1_release(struct usb_serial *serial)
+{
+	struct mxu1_device *mxdev;
+
+	mxdev = usb_get_serial_data(serial);
+	mxu1_ctrl_flush(mxdev);
+	mxu1_ctrl_pool_free(mxdev);
+	kfree(mxdev);
+}
+
+static void mxu1_fw_load_free(struct mxu1_fw_load *load)
+{
+	pm_runtime_put(&load->dev->dev);
+	usb_put_dev(load->dev);
+	kfree(load);
+}
+
+static void mxu1_fw_work(struct work_struct *work)
+{
+	struct mxu1_fw_load *load =
+		container_of(work, struct mxu1_fw_load, work);
+
+	mxu1_download_firmware(load->dev, load->image, load->endpoint);
+	mxu1_fw_load_free(load);
+}
+
+static void mxu1_fw_loaded(const struct firmware *fw_p, void *context)
+{
+	struct mxu1_fw_load *load = context;
+
+	if (!fw_p) {
+		dev_err(&load->dev->dev, "failed to request firmware\n");
+		mxu1_fw_load_free(load);
+		return;
+	}
+
+	dev_dbg(&load->dev->dev, "%s - request %lld us\n",
+		__func__, ktime_us_delta(ktime_get(), load->start));
+
+	load->image = mxu1_cache_firmware(load->model, fw_p);
+	release_firmware(fw_p);
+
+	if (!load->image) {
+		mxu1_fw_load_free(load);
+		return;
+	}
+
+	queue_work(mxu1_fw_wq, &load->work);
+}
+
+/* Start the firmware download of dev in the background */
+static int mxu1_fw_load_start(struct usb_device *dev, u16 model,
+			      u8 endpoint)
+{
+	struct mxu1_fw_load *load;
+	char fw_name[32];
+	int err;
+
+	load = kzalloc(sizeof(*load), GFP_KERNEL);
+	if (!load)
+		return -ENOMEM;
+
+	INIT_WORK(&load->work, mxu1_fw_work);
+	load->dev = usb_get_dev(dev);
+
+	/*
+	 * Probe holds the device awake; keep it from autosuspending until
+	 * the download is done, however long the firmware lookup takes.
+	 */
+	pm_runtime_get_noresume(&dev->dev);
+	load->model = model;
+	load->endpoint = endpoint;
+	load->start = ktime_get();
+
+	load->image = mxu1_find_firmware(model);
+	if (!load->image)
+		load->image = mxu1_builtin_firmware(model);
+	if (load->image) {
+		queue_work(mxu1_fw_wq, &load->work);
+		return 0;
+	}
+
+	snprintf(fw_name, sizeof(fw_name), "moxa/moxa-%04x.fw", model);
+
+	err = request_firmware_nowait(THIS_MODULE, FW_ACTION_HOTPLUG, fw_name,
+				      &dev->dev, GFP_KERNEL, load,
+				      mxu1_fw_loaded);
+	if (err) {
+		dev_err(&dev->dev, "failed to request firmware: %d\n", err);
+		mxu1_fw_load_free(load);
+		return err;
+	}
+
+	return 0;
+}
+
+static int mxu1_probe(struct usb_serial *serial, const struct usb_device_id *id)
+{
+	struct usb_host_interface *cur_altsetting;
+	struct usb_device *dev = serial->dev;
+	u16 model;
+	int err;
+	struct usb_endpoint_descriptor *endpoint, *interrupt_in, *bulk_out;
+	int i;
+
+	dev_dbg(&serial->interface->dev, "%s - product 0x%04X, num configurations %d, configuration value %d\n",
+		__func__, le16_to_cpu(dev->descriptor.idProduct),
+		dev->descriptor.bNumConfigurations,
+		dev->actconfig->desc.bConfigurationValue);
+
+	cur_altsetting = serial->interface->cur_altsetting;
+	interrupt_in = NULL;
+	bulk_out = NULL;
+
+	for (i = 0; i < cur_altsetting->desc.bNumEndpoints; i++) {
+		endpoint = &cur_altsetting->endpoint[i].desc;
+		if (usb_endpoint_is_bulk_out(endpoint)) {
+			dev_dbg(&serial->interface->dev,
+				"found bulk out on endpoint %d\n", i);
+			bulk_out = endpoint;
+		}
+
+		if (usb_endpoint_is_int_in(endpoint)) {
+			dev_dbg(&serial->interface->dev,
+				"found interrupt in on endpoint %d\n", i);
+			interrupt_in = endpoint;
+		}
+	}
+
+	/* if we have only 1 bulk out endpoint, download firmware */
+	if (bulk_out && (cur_altsetting->desc.bNumEndpoints == 1)) {
+
+		model = le16_to_cpu(dev->descriptor.idProduct);
+
+		err = mxu1_fw_load_start(dev, model,
+					 bulk_out->bEndpointAddress);
+		if (err)
+			return err;
+
+		/* device will be reset once the firmware is in */
+		return -ENODEV;
+
+	} else if (!interrupt_in) {
+		/* firmware is already loaded but there is
+		 * no interrupt in endpoint available
+		 */
+		dev_err(&serial->interface->dev, "no interrupt endpoint\n");
+		return -ENODEV;
+	}
+
+	mxu1_reenum_check(dev);
+
+	return 0;
+}
+
+static u16 mxu1_open_settings(struct mxu1_port *mxport)
+{
+	u8 timeout;
+
+	if (mxport->flags & ASYNC_LOW_LATENCY)
+		timeout = MXU1_LOW_LATENCY_TIMEOUT;
+	else if (mxport->adaptive)
+		timeout = mxport->cur_timeout;
+	else
+		timeout = mxport->pipe_timeout;
+
+	return MXU1_PIPE_MODE_CONTINUOUS | MXU1_PIPE_TIMEOUT_ENABLE |
+	       ((timeout << 2) & MXU1_PIPE_TIMEOUT_MASK);
+}
+
+/*
+ * Reprogram the bulk-in pipe timeout of an open port.  The firmware takes
+ * a new OPEN_PORT on an open port, which must be followed by START_PORT
+ * again; the port is neither stopped nor purged, so no data is lost.
+ * Serialized by mxport->mutex, under which the port is checked to still
+ * be open.
+ */
+static int mxu1_apply_pipe_timeout(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct usb_serial *serial = port->serial;
+	u16 settings;
+	int status = 0;
+
+	mutex_lock(&mxport->mutex);
+
+	if (!test_bit(ASYNCB_INITIALIZED, &port->port.flags) ||
+	    !mxport->dev_open)
+		goto out;
+
+	settings = mxu1_open_settings(mxport);
+
+	dev_dbg(&port->dev, "%s - open settings 0x%04X\n", __func__,
+		settings);
+
+	status = mxu1_send_ctrl_urb(serial, MXU1_OPEN_PORT, settings,
+				    MXU1_UART1_PORT);
+	if (status) {
+		dev_err(&port->dev, "cannot send open command: %d\n", status);
+		goto out;
+	}
+
+	status = mxu1_send_ctrl_urb(serial, MXU1_START_PORT,
+				    0, MXU1_UART1_PORT);
+	if (status) {
+		dev_err(&port->dev, "cannot send start command: %d\n", status);
+		goto out;
+	}
+
+	mxport->dev_settings = settings;
+out:
+	mutex_unlock(&mxport->mutex);
+
+	return status;
+}
+
+static ssize_t pipe_timeout_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	return sprintf(buf, "%u\n", mxport->pipe_timeout);
+}
+
+static ssize_t pipe_timeout_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int val;
+	int status;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	if (val < 1 || val > MXU1_TRANSFER_TIMEOUT_MAX)
+		return -EINVAL;
+
+	/* serialize against open and close */
+	mutex_lock(&port->port.mutex);
+	mxport->pipe_timeout = val;
+	status = mxu1_apply_pipe_timeout(port);
+	mutex_unlock(&port->port.mutex);
+
+	return status ? status : count;
+}
+static DEVICE_ATTR_RW(pipe_timeout);
+
+/*
+ * Cannot take the tty port mutex: close cancels this work synchronously
+ * while holding it.  Apply serializes on mxport->mutex instead, which
+ * close only takes after the cancel, and does nothing once the port is
+ * shut down.
+ */
+static void mxu1_adapt_work(struct work_struct *work)
+{
+	struct mxu1_port *mxport =
+		container_of(work, struct mxu1_port, adapt_work);
+
+	mxu1_apply_pipe_timeout(mxport->port);
+}
+
+/*
+ * Called for every bulk-in completion.  Once per window the average fill
+ * of the completions decides the pipe timeout: mostly full urbs mean a
+ * sustained stream that is best served by long transfers, mostly short
+ * ones mean sparse traffic that wants the bytes delivered immediately.
+ */
+static void mxu1_adapt_timeout(struct usb_serial_port *port, struct urb *urb)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct mxu1_timeout_change *change;
+	unsigned int size = urb->transfer_buffer_length;
+	unsigned long flags;
+	unsigned int fill;
+	u8 target;
+
+	if (!mxport->adaptive || (mxport->flags & ASYNC_LOW_LATENCY))
+		return;
+
+	spin_lock_irqsave(&mxport->rx_lock, flags);
+
+	mxport->adapt_completions++;
+	mxport->adapt_bytes += urb->actual_length;
+
+	if (!time_after(jiffies, mxport->adapt_start + MXU1_ADAPT_WINDOW))
+		goto out;
+
+	fill = mxport->adapt_bytes / mxport->adapt_completions;
+	target = mxport->cur_timeout;
+
+	if (fill >= size * 3 / 4)
+		target = MXU1_ADAPT_LONG_TIMEOUT;
+	else if (fill < size / 4)
+		target = MXU1_LOW_LATENCY_TIMEOUT;
+
+	if (target != mxport->cur_timeout) {
+		change = &mxport->history[mxport->history_count %
+					  MXU1_ADAPT_HISTORY];
+		change->time_ms = ktime_to_ms(ktime_get());
+		change->from = mxport->cur_timeout;
+		change->to = target;
+		change->fill = fill;
+		mxport->history_count++;
+
+		mxport->cur_timeout = target;
+		schedule_work(&mxport->adapt_work);
+	}
+
+	mxport->adapt_start = jiffies;
+	mxport->adapt_completions = 0;
+	mxport->adapt_bytes = 0;
+out:
+	spin_unlock_irqrestore(&mxport->rx_lock, flags);
+}
+
+static void mxu1_adapt_reset(struct mxu1_port *mxport)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&mxport->rx_lock, flags);
+	mxport->cur_timeout = mxport->pipe_timeout;
+	mxport->adapt_start = jiffies;
+	mxport->adapt_completions = 0;
+	mxport->adapt_bytes = 0;
+	spin_unlock_irqrestore(&mxport->rx_lock, flags);
+}
+
+static ssize_t adaptive_timeout_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	return sprintf(buf, "%d\n", mxport->adaptive);
+}
+
+static ssize_t adaptive_timeout_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	bool val;
+	int status;
+
+	if (strtobool(buf, &val))
+		return -EINVAL;
+
+	mutex_lock(&port->port.mutex);
+	mxu1_adapt_reset(mxport);
+	mxport->adaptive = val;
+	status = mxu1_apply_pipe_timeout(port);
+	mutex_unlock(&port->port.mutex);
+
+	return status ? status : count;
+}
+static DEVICE_ATTR_RW(adaptive_timeout);
+
+static ssize_t rx_urbs_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	return sprintf(buf, "%u\n", mxport->rx_urb_count);
+}
+
+/* Takes effect on the next open of the port */
+static ssize_t rx_urbs_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	if (val < 1 || val > MXU1_RX_URBS_MAX)
+		return -EINVAL;
+
+	mxport->rx_urb_count = val;
+
+	return count;
+}
+static DEVICE_ATTR_RW(rx_urbs);
+
+static ssize_t rx_urb_size_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	return sprintf(buf, "%u\n", mxport->rx_urb_size);
+}
+
+/*
+ * Takes effect on the next open of the port.  The size has to be a
+ * multiple of the bulk-in max packet size, or a full last packet would
+ * overflow the buffer.
+ */
+static ssize_t rx_urb_size_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int maxp;
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	if (val < MXU1_RX_URB_SIZE_MIN || val > MXU1_RX_URB_SIZE_MAX)
+		return -EINVAL;
+
+	maxp = usb_maxpacket(port->serial->dev,
+			     usb_rcvbulkpipe(port->serial->dev,
+					     port->bulk_in_endpointAddress), 0);
+	if (!maxp || val % maxp)
+		return -EINVAL;
+
+	mxport->rx_urb_size = val;
+
+	return count;
+}
+static DEVICE_ATTR_RW(rx_urb_size);
+
+static ssize_t tx_urbs_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	return sprintf(buf, "%u\n", mxport->tx_urb_count);
+}
+
+/* Takes effect on the next open of the port */
+static ssize_t tx_urbs_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	if (val < 1 || val > MXU1_TX_URBS_MAX)
+		return -EINVAL;
+
+	mxport->tx_urb_count = val;
+
+	return count;
+}
+static DEVICE_ATTR_RW(tx_urbs);
+
+static ssize_t close_linger_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	return sprintf(buf, "%u\n", mxport->close_linger);
+}
+
+static ssize_t close_linger_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	if (val > MXU1_CLOSE_LINGER_MAX)
+		return -EINVAL;
+
+	/* takes effect at the next close */
+	mxport->close_linger = val;
+
+	return count;
+}
+static DEVICE_ATTR_RW(close_linger);
+
+/* Replace one byte of the packed modem status word */
+static void mxu1_modem_store(struct mxu1_port *mxport, unsigned int shift,
+			     u8 val)
+{
+	int old, new;
+
+	do {
+		old = atomic_read(&mxport->modem);
+		new = (old & ~(0xff << shift)) | (val << shift);
+	} while (atomic_cmpxchg(&mxport->modem, old, new) != old);
+}
+
+static void mxu1_modem_load(struct mxu1_port *mxport, u8 *msr, u8 *mcr)
+{
+	int modem = atomic_read(&mxport->modem);
+
+	*msr = (modem >> MXU1_MODEM_MSR_SHIFT) & 0xff;
+	*mcr = (modem >> MXU1_MODEM_MCR_SHIFT) & 0xff;
+}
+
+/* Modem lines as TIOCM_* bits, from a single snapshot */
+static unsigned int mxu1_modem_tiocm(struct mxu1_port *mxport)
+{
+	u8 msr;
+	u8 mcr;
+
+	mxu1_modem_load(mxport, &msr, &mcr);
+
+	return ((mcr & MXU1_MCR_DTR)	? TIOCM_DTR	: 0) |
+	       ((mcr & MXU1_MCR_RTS)	? TIOCM_RTS	: 0) |
+	       ((mcr & MXU1_MCR_LOOP)	? TIOCM_LOOP	: 0) |
+	       ((msr & MXU1_MSR_CTS)	? TIOCM_CTS	: 0) |
+	       ((msr & MXU1_MSR_CD)	? TIOCM_CAR	: 0) |
+	       ((msr & MXU1_MSR_RI)	? TIOCM_RI	: 0) |
+	       ((msr & MXU1_MSR_DSR)	? TIOCM_DSR	: 0);
+}
+
+/*
+ * Modem lines of the port as a TIOCM_* bitmask, the value TIOCMGET
+ * returns.  The attribute is notified on every change of CTS, DSR, DCD
+ * or RI, so one poll() or epoll loop can wait on many ports for POLLPRI
+ * instead of a thread per port in TIOCMIWAIT.
+ */
+static ssize_t modem_status_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct usb_serial_port *port = to_usb_serial_port(dev);
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	return sprintf(buf, "0x%03x\n", mxu1_modem_tiocm(mxport));
+}
+static DEVICE_ATTR_RO(modem_status);
+
+static struct attribute *mxu1_port_attrs[] = {
+	&dev_attr_rx_urbs.attr,
+	&dev_attr_rx_urb_size.attr,
+	&dev_attr_tx_urbs.attr,
+	&dev_attr_pipe_timeout.attr,
+	&dev_attr_adaptive_timeout.attr,
+	&dev_attr_close_linger.attr,
+	&dev_attr_modem_status.attr,
+	NULL
+};
+
+static const struct attribute_group mxu1_port_attr_group = {
+	.attrs = mxu1_port_attrs,
+};
+
+static void mxu1_rx_stats(struct seq_file *m, struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	seq_printf(m, "rx_urbs_active %u\n", mxport->rx_urbs_alloc);
+	seq_printf(m, "rx_completions %lu\n", mxport->rx_completions);
+	seq_printf(m, "rx_full %lu\n", mxport->rx_full);
+	seq_printf(m, "rx_bytes %lu\n", mxport->rx_bytes);
+	seq_printf(m, "rx_errors %lu\n", mxport->rx_errors);
+	seq_printf(m, "rx_overruns %u\n", port->icount.overrun);
+	seq_printf(m, "rx_buf_overruns %u\n", port->icount.buf_overrun);
+}
+
+static void mxu1_tx_stats(struct seq_file *m, struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	seq_printf(m, "tx_urbs_active %u\n", mxport->tx_urbs_alloc);
+	seq_printf(m, "tx_inflight %u\n", mxport->tx_inflight);
+	seq_printf(m, "tx_inflight_max %u\n", mxport->tx_inflight_max);
+	seq_printf(m, "tx_submitted %lu\n", mxport->tx_submitted);
+	seq_printf(m, "tx_bytes %lu\n", mxport->tx_total_bytes);
+	seq_printf(m, "tx_depth_sum %lu\n", mxport->tx_depth_sum);
+	seq_printf(m, "tx_saturated %lu\n", mxport->tx_saturated);
+	seq_printf(m, "tx_errors %lu\n", mxport->tx_errors);
+}
+
+static void mxu1_timeout_stats(struct seq_file *m,
+			       struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct mxu1_timeout_change *change;
+	unsigned long flags;
+	unsigned int first;
+	unsigned int i;
+
+	spin_lock_irqsave(&mxport->rx_lock, flags);
+
+	seq_printf(m, "pipe_timeout_current %u\n",
+		   (mxu1_open_settings(mxport) & MXU1_PIPE_TIMEOUT_MASK) >> 2);
+
+	first = 0;
+	if (mxport->history_count > MXU1_ADAPT_HISTORY)
+		first = mxport->history_count - MXU1_ADAPT_HISTORY;
+
+	for (i = first; i < mxport->history_count; i++) {
+		change = &mxport->history[i % MXU1_ADAPT_HISTORY];
+		seq_printf(m, "pipe_timeout_change %lld %u -> %u fill %u\n",
+			   change->time_ms, change->from, change->to,
+			   change->fill);
+	}
+
+	spin_unlock_irqrestore(&mxport->rx_lock, flags);
+}
+
+static void mxu1_break_stats(struct seq_file *m,
+			     struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
+	unsigned long count;
+	s64 last, max, total;
+
+	spin_lock_irqsave(&mxport->spinlock, flags);
+	count = mxport->break_count;
+	last = mxport->break_last_us;
+	max = mxport->break_max_us;
+	total = mxport->break_total_us;
+	spin_unlock_irqrestore(&mxport->spinlock, flags);
+
+	seq_printf(m, "break_count %lu\n", count);
+	seq_printf(m, "break_last_us %lld\n", last);
+	seq_printf(m, "break_max_us %lld\n", max);
+	seq_printf(m, "break_avg_us %lld\n",
+		   count ? div_s64(total, count) : 0);
+}
+
+static void mxu1_open_stats(struct seq_file *m, struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
+	unsigned long count, lingered;
+	s64 last, min, max, total;
+
+	spin_lock_irqsave(&mxport->spinlock, flags);
+	count = mxport->open_count;
+	lingered = mxport->open_lingered;
+	last = mxport->open_last_us;
+	min = mxport->open_min_us;
+	max = mxport->open_max_us;
+	total = mxport->open_total_us;
+	spin_unlock_irqrestore(&mxport->spinlock, flags);
+
+	seq_printf(m, "open_count %lu\n", count);
+	seq_printf(m, "open_lingered %lu\n", lingered);
+	seq_printf(m, "open_last_us %lld\n", last);
+	seq_printf(m, "open_min_us %lld\n", min);
+	seq_printf(m, "open_max_us %lld\n", max);
+	seq_printf(m, "open_avg_us %lld\n",
+		   count ? div_s64(total, count) : 0);
+}
+
+static void mxu1_ctrl_stats(struct seq_file *m, struct usb_serial_port *port)
+{
+	struct mxu1_device *mxdev = usb_get_serial_data(port->serial);
+	unsigned long requests, issued, errors, timeouts, dropped;
+	unsigned long flags;
+	s64 total, max;
+	u8 last;
+
+	spin_lock_irqsave(&mxdev->ctrl_lock, flags);
+	requests = mxdev->ctrl_requests;
+	issued = mxdev->ctrl_issued;
+	errors = mxdev->ctrl_errors;
+	timeouts = mxdev->ctrl_timeouts;
+	dropped = mxdev->ctrl_dropped;
+	last = mxdev->ctrl_last_timeout;
+	total = mxdev->ctrl_total_us;
+	max = mxdev->ctrl_max_us;
+	spin_unlock_irqrestore(&mxdev->ctrl_lock, flags);
+
+	seq_printf(m, "ctrl_requests %lu\n", requests);
+	seq_printf(m, "ctrl_issued %lu\n", issued);
+	seq_printf(m, "ctrl_errors %lu\n", errors);
+	seq_printf(m, "ctrl_timeouts %lu\n", timeouts);
+	seq_printf(m, "ctrl_last_timeout 0x%02X\n", last);
+	seq_printf(m, "ctrl_dropped %lu\n", dropped);
+	seq_printf(m, "ctrl_avg_us %lld\n",
+		   issued ? div_s64(total, issued) : 0);
+	seq_printf(m, "ctrl_max_us %lld\n", max);
+}
+
+static void mxu1_firmware_stats(struct seq_file *m,
+				struct usb_serial_port *port)
+{
+	struct mxu1_device *mxdev = usb_get_serial_data(port->serial);
+
+	/* the version is only asked for when recovering from a reset */
+	if (mxdev->fw_version_valid) {
+		seq_printf(m, "firmware_version %u.%u\n",
+			   mxdev->fw_version.bMajor, mxdev->fw_version.bMinor);
+	} else {
+		seq_puts(m, "firmware_version unknown\n");
+	}
+	seq_printf(m, "recoveries %lu\n", mxdev->recoveries);
+	seq_printf(m, "last_recovery_us %lld\n", mxdev->recovery_last_us);
+}
+
+static void mxu1_modem_stats(struct seq_file *m,
+			     struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	seq_printf(m, "modem_events %u\n", READ_ONCE(mxport->msr_head));
+}
+
+static void mxu1_interrupt_stats(struct seq_file *m,
+				 struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	seq_printf(m, "int_records %lu\n", mxport->int_records);
+	seq_printf(m, "int_malformed %lu\n", mxport->int_malformed);
+	seq_printf(m, "int_hw_errors %lu\n", mxport->int_hw_errors);
+	seq_printf(m, "int_unknown %lu\n", mxport->int_unknown);
+	seq_printf(m, "int_urb_errors %lu\n", mxport->int_urb_errors);
+	seq_printf(m, "msr_dropped %d\n", atomic_read(&mxport->msr_dropped));
+}
+
+/*
+ * Counters and logs of the port, for debugging and tuning only; unlike
+ * the sysfs attributes the format is not fixed.
+ */
+static int mxu1_stats_show(struct seq_file *m, void *v)
+{
+	struct usb_serial_port *port = m->private;
+
+	mxu1_rx_stats(m, port);
+	mxu1_tx_stats(m, port);
+	mxu1_timeout_stats(m, port);
+	mxu1_break_stats(m, port);
+	mxu1_open_stats(m, port);
+	mxu1_ctrl_stats(m, port);
+	mxu1_firmware_stats(m, port);
+	mxu1_modem_stats(m, port);
+	mxu1_interrupt_stats(m, port);
+
+	return 0;
+}
+
+static int mxu1_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mxu1_stats_show, inode->i_private);
+}
+
+static const struct file_operations mxu1_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mxu1_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void mxu1_drain_work(struct work_struct *work)
+{
+	struct mxu1_port *mxport =
+		container_of(to_delayed_work(work), struct mxu1_port,
+			     drain_work);
+
+	tty_port_tty_wakeup(&mxport->port->port);
+}
+
+/* Start both interrupt urbs; they complete in submission order */
+static int mxu1_int_submit(struct usb_serial_port *port, gfp_t mem_flags)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	int status;
+
+	status = usb_submit_urb(port->interrupt_in_urb, mem_flags);
+	if (status)
+		return status;
+
+	status = usb_submit_urb(mxport->int_urb, mem_flags);
+	if (status)
+		usb_kill_urb(port->interrupt_in_urb);
+
+	return status;
+}
+
+static void mxu1_int_kill(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+
+	usb_kill_urb(port->interrupt_in_urb);
+	usb_kill_urb(mxport->int_urb);
+}
+
+/*
+ * Take the device side port down: stop the interrupt urb and close the
+ * port in the firmware.  Called with mxport->mutex held.
+ */
+static void mxu1_port_shutdown(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	int status;
+
+	mxu1_int_kill(port);
+	mxport->dev_open = false;
+
+	if (mxu1_device_gone(port->serial))
+		return;
+
+	status = mxu1_send_ctrl_urb(port->serial, MXU1_STOP_PORT,
+				    0, MXU1_UART1_PORT);
+	if (status) {
+		dev_err(&port->dev, "failed to send stop port command: %d\n",
+			status);
+	}
+
+	status = mxu1_send_ctrl_urb(port->serial, MXU1_CLOSE_PORT,
+				    0, MXU1_UART1_PORT);
+	if (status) {
+		dev_err(&port->dev, "failed to send close port command: %d\n",
+			status);
+	}
+}
+
+/* The linger window after the last close expired without a reopen */
+static void mxu1_linger_work(struct work_struct *work)
+{
+	struct mxu1_port *mxport =
+		container_of(to_delayed_work(work), struct mxu1_port,
+			     linger_work);
+	struct usb_serial *serial = mxport->port->serial;
+	int autopm;
+
+	dev_dbg(&mxport->port->dev, "%s - closing lingering port\n",
+		__func__);
+
+	/* the interface may have been autosuspended since the close */
+	autopm = usb_autopm_get_interface(serial->interface);
+
+	mutex_lock(&mxport->mutex);
+	if (mxport->dev_open)
+		mxu1_port_shutdown(mxport->port);
+	mutex_unlock(&mxport->mutex);
+
+	if (!autopm)
+		usb_autopm_put_interface(serial->interface);
+}
+
+static int mxu1_port_probe(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport;
+	struct mxu1_device *mxdev;
+	struct urb *int_urb = port->interrupt_in_urb;
+	u8 *buffer;
+	int status;
+
+	mxport = kzalloc(sizeof(struct mxu1_port), GFP_KERNEL);
+	if (!mxport)
+		return -ENOMEM;
+
+	/* a twin of the core's interrupt urb, with the same handler */
+	mxport->int_urb = usb_alloc_urb(0, GFP_KERNEL);
+	buffer = kmalloc(int_urb->transfer_buffer_length, GFP_KERNEL);
+	if (!mxport->int_urb || !buffer) {
+		kfree(buffer);
+		usb_free_urb(mxport->int_urb);
+		kfree(mxport);
+		return -ENOMEM;
+	}
+
+	usb_fill_int_urb(mxport->int_urb, port->serial->dev, int_urb->pipe,
+			 buffer, int_urb->transfer_buffer_length,
+			 int_urb->complete, port, 0);
+	mxport->int_urb->interval = int_urb->interval;
+	mxport->int_urb->transfer_flags |= URB_FREE_BUFFER;
+
+	spin_lock_init(&mxport->spinlock);
+	mutex_init(&mxport->mutex);
+	mutex_init(&mxport->msr_ring_mutex);
+
+	spin_lock_init(&mxport->rx_lock);
+	init_usb_anchor(&mxport->rx_parked);
+	mxport->rx_urb_count = MXU1_RX_URBS_DEFAULT;
+	mxport->rx_urb_size = MXU1_RX_URB_SIZE_DEFAULT;
+	mxport->tx_urb_count = MXU1_TX_URBS_DEFAULT;
+	mxport->pipe_timeout = MXU1_TRANSFER_TIMEOUT;
+	mxport->cur_timeout = MXU1_TRANSFER_TIMEOUT;
+	mxport->port = port;
+	mxport->baud = 9600;
+	INIT_WORK(&mxport->adapt_work, mxu1_adapt_work);
+	INIT_DELAYED_WORK(&mxport->drain_work, mxu1_drain_work);
+	INIT_DELAYED_WORK(&mxport->linger_work, mxu1_linger_work);
+
+	mxdev = usb_get_serial_data(port->serial);
+
+	switch (mxdev->mxd_model) {
+	case MXU1_1110_PRODUCT_ID:
+	case MXU1_1150_PRODUCT_ID:
+	case MXU1_1151_PRODUCT_ID:
+		mxport->uart_mode = MXU1_UART_232;
+		break;
+	case MXU1_1130_PRODUCT_ID:
+	case MXU1_1131_PRODUCT_ID:
+		mxport->uart_mode = MXU1_UART_485_RECEIVER_DISABLED;
+		break;
+	}
+
+	usb_set_serial_port_data(port, mxport);
+
+	port->port.closing_wait =
+			msecs_to_jiffies(MXU1_DEFAULT_CLOSING_WAIT * 10);
+	port->port.drain_delay = 1;
+
+	status = sysfs_create_group(&port->dev.kobj, &mxu1_port_attr_group);
+	if (status) {
+		usb_free_urb(mxport->int_urb);
+		kfree(mxport);
+		return status;
+	}
+
+	/* looked up once, as it is notified from urb completion */
+	mxport->modem_kn = sysfs_get_dirent(port->dev.kobj.sd, "modem_status");
+
+	mxport->debugfs = debugfs_create_file(dev_name(&port->dev), 0444,
+					      mxu1_debugfs, port,
+					      &mxu1_stats_fops);
+
+	return 0;
+}
+
+static int mxu1_port_remove(struct usb_serial_port *port)
+{
+	struct mxu1_device *mxdev = usb_get_serial_data(port->serial);
+	struct mxu1_port *mxport;
+
+	mxport = usb_get_serial_port_data(port);
+
+	/* the device is going away, a lingering port needs no commands */
+	cancel_delayed_work_sync(&mxport->linger_work);
+	if (mxport->dev_open) {
+		mxu1_int_kill(port);
+		mxport->dev_open = false;
+	}
+
+	/*
+	 * Ports are removed before mxu1_disconnect runs, so fail what is
+	 * still queued for an unplugged device here, then wait for every
+	 * completion that writes to mxport.
+	 */
+	if (port->serial->disconnected)
+		mxu1_ctrl_flush(mxdev);
+	wait_event(mxdev->ctrl_wait, !atomic_read(&mxport->ctrl_pending));
+	usb_free_urb(mxport->int_urb);
+
+	debugfs_remove(mxport->debugfs);
+	sysfs_put(mxport->modem_kn);
+	sysfs_remove_group(&port->dev.kobj, &mxu1_port_attr_group);
+	kfree(mxport);
+
+	return 0;
+}
+
+static int mxu1_startup(struct usb_serial *serial)
+{
+	struct mxu1_device *mxdev;
+
+	/* create device structure */
+	mxdev = kzalloc(sizeof(struct mxu1_device), GFP_KERNEL);
+	if (!mxdev)
+		return -ENOMEM;
+
+	mxdev->serial = serial;
+	spin_lock_init(&mxdev->ctrl_lock);
+	INIT_LIST_HEAD(&mxdev->ctrl_queue);
+	setup_timer(&mxdev->ctrl_timer, mxu1_ctrl_timeout,
+		    (unsigned long)mxdev);
+
+	if (mxu1_ctrl_pool_alloc(mxdev)) {
+		kfree(mxdev);
+		return -ENOMEM;
+	}
+
+	usb_set_serial_data(serial, mxdev);
+
+	return 0;
+}
+
+/*
+ * Write one byte of the UART register space.  Without wait the write is
+ * only queued; it still reaches the device in order with every other
+ * vendor request, and complete is called with its final status.
+ */
+static int mxu1_write_byte(struct usb_serial_port *port, u32 addr,
+			   u8 mask, u8 byte, bool wait,
+			   mxu1_ctrl_complete_t complete, void *context)
+{
+	u8 buf[sizeof(struct mxu1_write_data_bytes) + 2];
+	struct mxu1_write_data_bytes *data = (void *)buf;
+	size_t size = sizeof(buf);
+	int status;
+
+	dev_dbg(&port->dev, "%s - addr 0x%08X, mask 0x%02X, byte 0x%02X\n",
+		__func__, addr, mask, byte);
+
+	data->bAddrType = MXU1_RW_DATA_ADDR_XDATA;
+	data->bDataType = MXU1_RW_DATA_BYTE;
+	data->bDataCounter = 1;
+	data->wBaseAddrHi = cpu_to_be16(addr >> 16);
+	data->wBaseAddrLo = cpu_to_be16(addr);
+	data->bData[0] = mask;
+	data->bData[1] = byte;
+
+	if (wait) {
+		status = mxu1_send_ctrl_data_urb(port->serial, MXU1_WRITE_DATA,
+						 0, MXU1_RAM_PORT, data, size);
+	} else {
+		status = mxu1_send_ctrl_data_urb_async(port->serial,
+						       MXU1_WRITE_DATA, 0,
+						       MXU1_RAM_PORT, data, size,
+						       complete, context);
+	}
+	if (status < 0)
+		dev_err(&port->dev, "%s - failed: %d\n", __func__, status);
+
+	return status;
+}
+
+/*
+ * Asynchronous requests with mxport as their context are counted, so
+ * that mxu1_port_remove can wait for their completions before freeing
+ * the port.
+ */
+static void mxu1_port_ctrl_get(struct mxu1_port *mxport)
+{
+	atomic_inc(&mxport->ctrl_pending);
+}
+
+static void mxu1_port_ctrl_put(struct mxu1_port *mxport)
+{
+	struct mxu1_device *mxdev = usb_get_serial_data(mxport->port->serial);
+
+	/* mxport may be freed as soon as the count drops to zero */
+	if (atomic_dec_and_test(&mxport->ctrl_pending))
+		wake_up(&mxdev->ctrl_wait);
+}
+
+/* A queued write failed, so the device state is no longer known */
+static void mxu1_mcr_complete(void *context, int status)
+{
+	struct mxu1_port *mxport = context;
+
+	if (status)
+		mxport->mcr_valid = false;
+
+	mxu1_port_ctrl_put(mxport);
+}
+
+static void mxu1_config_complete(void *context, int status)
+{
+	struct mxu1_port *mxport = context;
+
+	if (status)
+		mxport->config_valid = false;
+
+	mxu1_port_ctrl_put(mxport);
+}
+
+/* Record a new mcr; called with mxport->mutex held */
+static void mxu1_mcr_store(struct mxu1_port *mxport, u8 mcr)
+{
+	mxport->mcr = mcr;
+	mxu1_modem_store(mxport, MXU1_MODEM_MCR_SHIFT, mcr);
+}
+
+/* Called with mxport->mutex held */
+static int mxu1_set_mcr(struct usb_serial_port *port, unsigned int mcr,
+			bool wait)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	int status;
+
+	if (mxport->mcr_valid && mxport->mcr == mcr) {
+		dev_dbg(&port->dev, "%s - mcr unchanged\n", __func__);
+		return 0;
+	}
+
+	/* set before queueing, a failed completion clears it again */
+	mxport->mcr_valid = true;
+
+	if (!wait)
+		mxu1_port_ctrl_get(mxport);
+
+	status = mxu1_write_byte(port,
+				 MXU1_UART_BASE_ADDR + MXU1_UART_OFFSET_MCR,
 				 MXU1_MCR_RTS | MXU1_MCR_DTR | MXU1_MCR_LOOP,
-				 mcr);
+				 mcr, wait, mxu1_mcr_complete, mxport);
+	if (status) {
+		mxport->mcr_valid = false;
+		if (!wait)
+			mxu1_port_ctrl_put(mxport);
+	}
+
+	return status;
+}
+
+static int mxu1_get_lsr(struct usb_serial_port *port, u8 *lsr)
+{
+	struct mxu1_port_status data;
+	int status;
+
+	status = mxu1_recv_ctrl_urb(port->serial, MXU1_GET_PORT_STATUS, 0,
+				    MXU1_UART1_PORT, &data, sizeof(data));
+	if (status) {
+		dev_err(&port->dev, "%s - get port status command failed: %d\n",
+			__func__, status);
+		return status;
+	}
+
+	dev_dbg(&port->dev, "%s - lsr 0x%02X\n", __func__, data.bLSR);
+
+	*lsr = data.bLSR;
+
+	return 0;
+}
+
+static int mxu1_get_outqueue(struct usb_serial_port *port,
+			     unsigned int *count)
+{
+	struct mxu1_outqueue data;
+	int status;
+
+	status = mxu1_recv_ctrl_urb(port->serial, MXU1_GET_OUTQUEUE, 0,
+				    MXU1_UART1_PORT, &data, sizeof(data));
+	if (status) {
+		dev_err(&port->dev, "%s - get outqueue command failed: %d\n",
+			__func__, status);
+		return status;
+	}
+
+	*count = be16_to_cpu(data.wCount);
+
+	dev_dbg(&port->dev, "%s - %u bytes queued\n", __func__, *count);
+
+	return 0;
+}
+
+static void mxu1_change_termios(struct tty_struct *tty,
+				struct usb_serial_port *port,
+				struct ktermios *old_termios, bool wait)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct mxu1_uart_config config;
+	tcflag_t cflag, iflag;
+	speed_t baud;
+	int status;
+	unsigned int mcr;
+
+	cflag = tty->termios.c_cflag;
+	iflag = tty->termios.c_iflag;
+
+	if (old_termios &&
+	    !tty_termios_hw_change(&tty->termios, old_termios) &&
+	    tty->termios.c_iflag == old_termios->c_iflag) {
+		dev_dbg(&port->dev, "%s - nothing to change\n", __func__);
+		return;
+	}
+
+	dev_dbg(&port->dev,
+		"%s - cflag 0x%08x, iflag 0x%08x\n", __func__, cflag, iflag);
+
+	if (old_termios) {
+		dev_dbg(&port->dev, "%s - old cflag 0x%08x, old iflag 0x%08x\n",
+			__func__,
+			old_termios->c_cflag,
+			old_termios->c_iflag);
+	}
+
+	memset(&config, 0, sizeof(config));
+
+	/* these flags must be set */
+	config.wFlags |= MXU1_UART_ENABLE_MS_INTS;
+	config.wFlags |= MXU1_UART_ENABLE_AUTO_START_DMA;
+	config.bUartMode = mxport->uart_mode;
+
+	switch (C_CSIZE(tty)) {
+	case CS5:
+		config.bDataBits = MXU1_UART_5_DATA_BITS;
+		break;
+	case CS6:
+		config.bDataBits = MXU1_UART_6_DATA_BITS;
+		break;
+	case CS7:
+		config.bDataBits = MXU1_UART_7_DATA_BITS;
+		break;
+	default:
+	case CS8:
+		config.bDataBits = MXU1_UART_8_DATA_BITS;
+		break;
+	}
+
+	if (C_PARENB(tty)) {
+		config.wFlags |= MXU1_UART_ENABLE_PARITY_CHECKING;
+		if (C_CMSPAR(tty)) {
+			if (C_PARODD(tty))
+				config.bParity = MXU1_UART_MARK_PARITY;
+			else
+				config.bParity = MXU1_UART_SPACE_PARITY;
+		} else {
+			if (C_PARODD(tty))
+				config.bParity = MXU1_UART_ODD_PARITY;
+			else
+				config.bParity = MXU1_UART_EVEN_PARITY;
+		}
+	} else {
+		config.bParity = MXU1_UART_NO_PARITY;
+	}
+
+	if (C_CSTOPB(tty))
+		config.bStopBits = MXU1_UART_2_STOP_BITS;
+	else
+		config.bStopBits = MXU1_UART_1_STOP_BITS;
+
+	if (C_CRTSCTS(tty)) {
+		/* RTS flow control must be off to drop RTS for baud rate B0 */
+		if (C_BAUD(tty) != B0)
+			config.wFlags |= MXU1_UART_ENABLE_RTS_IN;
+		config.wFlags |= MXU1_UART_ENABLE_CTS_OUT;
+	}
+
+	if (I_IXOFF(tty) || I_IXON(tty)) {
+		config.cXon  = START_CHAR(tty);
+		config.cXoff = STOP_CHAR(tty);
+
+		if (I_IXOFF(tty))
+			config.wFlags |= MXU1_UART_ENABLE_X_IN;
+
+		if (I_IXON(tty))
+			config.wFlags |= MXU1_UART_ENABLE_X_OUT;
+	}
+
+	baud = tty_get_baud_rate(tty);
+	if (!baud)
+		baud = 9600;
+	config.wBaudRate = MXU1_BAUD_BASE / baud;
+	mxport->baud = baud;
+
+	dev_dbg(&port->dev, "%s - BaudRate=%d, wBaudRate=%d, wFlags=0x%04X, bDataBits=%d, bParity=%d, bStopBits=%d, cXon=%d, cXoff=%d, bUartMode=%d\n",
+		__func__, baud, config.wBaudRate, config.wFlags,
+		config.bDataBits, config.bParity, config.bStopBits,
+		config.cXon, config.cXoff, config.bUartMode);
+
+	cpu_to_be16s(&config.wBaudRate);
+	cpu_to_be16s(&config.wFlags);
+
+	mutex_lock(&mxport->mutex);
+
+	/* keep an ongoing break across the reconfiguration */
+	if (mxport->send_break)
+		config.wFlags |= cpu_to_be16(MXU1_UART_SEND_BREAK_SIGNAL);
+
+	if (mxport->config_valid &&
+	    !memcmp(&mxport->config, &config, sizeof(config))) {
+		dev_dbg(&port->dev, "%s - config unchanged\n", __func__);
+	} else {
+		mxport->config = config;
+		mxport->config_valid = true;
+
+		if (wait) {
+			status = mxu1_send_ctrl_data_urb(port->serial,
+							 MXU1_SET_CONFIG, 0,
+							 MXU1_UART1_PORT,
+							 &config,
+							 sizeof(config));
+		} else {
+			mxu1_port_ctrl_get(mxport);
+			status = mxu1_send_ctrl_data_urb_async(port->serial,
+							MXU1_SET_CONFIG, 0,
+							MXU1_UART1_PORT,
+							&config, sizeof(config),
+							mxu1_config_complete,
+							mxport);
+			if (status)
+				mxu1_port_ctrl_put(mxport);
+		}
+		if (status) {
+			dev_err(&port->dev, "cannot set config: %d\n", status);
+			mxport->config_valid = false;
+		}
+	}
+
+	mcr = mxport->mcr;
+
+	if (C_BAUD(tty) == B0)
+		mcr &= ~(MXU1_MCR_DTR | MXU1_MCR_RTS);
+	else if (old_termios && (old_termios->c_cflag & CBAUD) == B0)
+		mcr |= MXU1_MCR_DTR | MXU1_MCR_RTS;
+
+	status = mxu1_set_mcr(port, mcr, wait);
+	if (status)
+		dev_err(&port->dev, "cannot set modem control: %d\n", status);
+	else
+		mxu1_mcr_store(mxport, mcr);
+
+	mutex_unlock(&mxport->mutex);
+}
+
+static void mxu1_set_termios(struct tty_struct *tty,
+			     struct usb_serial_port *port,
+			     struct ktermios *old_termios)
+{
+	mxu1_change_termios(tty, port, old_termios, true);
+}
+
+static int mxu1_get_serial_info(struct usb_serial_port *port,
+				struct serial_struct __user *ret_arg)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct serial_struct ret_serial;
+	unsigned cwait;
+
+	if (!ret_arg)
+		return -EFAULT;
+
+	cwait = port->port.closing_wait;
+	if (cwait != ASYNC_CLOSING_WAIT_NONE)
+		cwait = jiffies_to_msecs(cwait) / 10;
+
+	memset(&ret_serial, 0, sizeof(ret_serial));
+
+	ret_serial.type = PORT_16550A;
+	ret_serial.line = port->minor;
+	ret_serial.port = 0;
+	ret_serial.flags = mxport->flags;
+	ret_serial.xmit_fifo_size = port->bulk_out_size;
+	ret_serial.baud_base = MXU1_BAUD_BASE;
+	ret_serial.close_delay = 5*HZ;
+	ret_serial.closing_wait = cwait;
+
+	if (copy_to_user(ret_arg, &ret_serial, sizeof(*ret_arg)))
+		return -EFAULT;
+
+	return 0;
+}
+
+
+static int mxu1_set_serial_info(struct usb_serial_port *port,
+				struct serial_struct __user *new_arg)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct serial_struct new_serial;
+	unsigned cwait;
+	u32 old_flags;
+	int status = 0;
+
+	if (copy_from_user(&new_serial, new_arg, sizeof(new_serial)))
+		return -EFAULT;
+
+	cwait = new_serial.closing_wait;
+	if (cwait != ASYNC_CLOSING_WAIT_NONE)
+		cwait = msecs_to_jiffies(10 * new_serial.closing_wait);
+
+	port->port.closing_wait = cwait;
+
+	/* serialize against open, close and the sysfs attributes */
+	mutex_lock(&port->port.mutex);
+	old_flags = mxport->flags;
+	mxport->flags = new_serial.flags & ASYNC_LOW_LATENCY;
+
+	if ((old_flags ^ mxport->flags) & ASYNC_LOW_LATENCY)
+		status = mxu1_apply_pipe_timeout(port);
+	mutex_unlock(&port->port.mutex);
+
+	return status;
+}
+
+/* Queue a modem status change; called from the interrupt urb only */
+static void mxu1_msr_record(struct mxu1_port *mxport, u8 msr)
+{
+	struct mxu1_msr_event *event;
+	unsigned int head = mxport->msr_head;
+
+	if (head - smp_load_acquire(&mxport->msr_tail) >= MXU1_MSR_RING_SIZE) {
+		atomic_inc(&mxport->msr_dropped);
+		return;
+	}
+
+	event = &mxport->msr_ring[head & (MXU1_MSR_RING_SIZE - 1)];
+	event->timestamp_ns = ktime_get_ns();
+	event->msr = msr;
+
+	smp_store_release(&mxport->msr_head, head + 1);
+}
+
+/* Forget queued modem status changes; the interrupt urb must be idle */
+static void mxu1_msr_reset(struct mxu1_port *mxport)
+{
+	mutex_lock(&mxport->msr_ring_mutex);
+	mxport->msr_head = 0;
+	mxport->msr_tail = 0;
+	atomic_set(&mxport->msr_dropped, 0);
+	mutex_unlock(&mxport->msr_ring_mutex);
+}
+
+/* Drain up to arg->count queued modem status changes in one call */
+static int mxu1_get_msr_events(struct usb_serial_port *port,
+			       struct mxu1_msr_events __user *arg)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct mxu1_msr_event __user *events;
+	struct mxu1_msr_events req;
+	unsigned int head, tail;
+	unsigned int n = 0;
+	int status = 0;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	events = (struct mxu1_msr_event __user *)(unsigned long)req.events;
+
+	mutex_lock(&mxport->msr_ring_mutex);
+
+	head = smp_load_acquire(&mxport->msr_head);
+	tail = mxport->msr_tail;
+
+	/* slots before head are not touched by the producer until freed */
+	while (n < req.count && tail != head) {
+		if (copy_to_user(&events[n],
+				 &mxport->msr_ring[tail &
+						   (MXU1_MSR_RING_SIZE - 1)],
+				 sizeof(*events))) {
+			status = -EFAULT;
+			break;
+		}
+		n++;
+		tail++;
+	}
+
+	smp_store_release(&mxport->msr_tail, tail);
+
+	req.count = n;
+	req.dropped = atomic_xchg(&mxport->msr_dropped, 0);
+
+	mutex_unlock(&mxport->msr_ring_mutex);
+
+	if (!status && copy_to_user(arg, &req, sizeof(req)))
+		status = -EFAULT;
+
 	return status;
 }
 
-static void mxu1_set_termios(struct tty_struct *tty,
-			     struct usb_serial_port *port,
-			     struct ktermios *old_termios)
+static int mxu1_ioctl(struct tty_struct *tty,
+		      unsigned int cmd, unsigned long arg)
+{
+	struct usb_serial_port *port = tty->driver_data;
+
+	switch (cmd) {
+	case TIOCGSERIAL:
+		return mxu1_get_serial_info(port,
+					    (struct serial_struct __user *)arg);
+	case TIOCSSERIAL:
+		return mxu1_set_serial_info(port,
+					    (struct serial_struct __user *)arg);
+	case MOXA_GET_MSR_EVENTS:
+		return mxu1_get_msr_events(port,
+					   (struct mxu1_msr_events __user *)arg);
+	}
+
+	return -ENOIOCTLCMD;
+}
+
+static int mxu1_tiocmget(struct tty_struct *tty)
+{
+	struct usb_serial_port *port = tty->driver_data;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int result;
+
+	result = mxu1_modem_tiocm(mxport);
+
+	dev_dbg(&port->dev, "%s - 0x%04X\n", __func__, result);
+
+	return result;
+}
+
+static int mxu1_tiocmset(struct tty_struct *tty,
+			 unsigned int set, unsigned int clear)
+{
+	struct usb_serial_port *port = tty->driver_data;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	int err;
+	unsigned int mcr;
+
+	mutex_lock(&mxport->mutex);
+	mcr = mxport->mcr;
+
+	if (set & TIOCM_RTS)
+		mcr |= MXU1_MCR_RTS;
+	if (set & TIOCM_DTR)
+		mcr |= MXU1_MCR_DTR;
+	if (set & TIOCM_LOOP)
+		mcr |= MXU1_MCR_LOOP;
+
+	if (clear & TIOCM_RTS)
+		mcr &= ~MXU1_MCR_RTS;
+	if (clear & TIOCM_DTR)
+		mcr &= ~MXU1_MCR_DTR;
+	if (clear & TIOCM_LOOP)
+		mcr &= ~MXU1_MCR_LOOP;
+
+	/* queued behind any earlier request; failures are logged */
+	err = mxu1_set_mcr(port, mcr, false);
+	if (!err)
+		mxu1_mcr_store(mxport, mcr);
+
+	mutex_unlock(&mxport->mutex);
+
+	return err;
+}
+
+static void mxu1_break_complete(void *context, int status)
+{
+	struct mxu1_port *mxport = context;
+	struct mxu1_break_stamp *stamp;
+	unsigned long flags;
+	s64 us;
+
+	spin_lock_irqsave(&mxport->spinlock, flags);
+	stamp = &mxport->break_issued[mxport->break_tail % MXU1_BREAK_INFLIGHT];
+	if (mxport->break_tail != mxport->break_head &&
+	    stamp->seq == mxport->break_done) {
+		us = ktime_us_delta(ktime_get(), stamp->issued);
+		mxport->break_tail++;
+
+		mxport->break_count++;
+		mxport->break_last_us = us;
+		mxport->break_total_us += us;
+		if (us > mxport->break_max_us)
+			mxport->break_max_us = us;
+	}
+	mxport->break_done++;
+	spin_unlock_irqrestore(&mxport->spinlock, flags);
+
+	mxu1_port_ctrl_put(mxport);
+}
+
+static void mxu1_break(struct tty_struct *tty, int break_state)
 {
+	struct usb_serial_port *port = tty->driver_data;
 	struct mxu1_port *mxport = usb_get_serial_port_data(port);
-	struct mxu1_uart_config *config;
-	tcflag_t cflag, iflag;
-	speed_t baud;
+	struct mxu1_break_stamp *stamp;
+	unsigned long flags;
+	bool stamped = false;
 	int status;
-	unsigned int mcr;
+	u8 lcr;
 
-	cflag = tty->termios.c_cflag;
-	iflag = tty->termios.c_iflag;
+	mutex_lock(&mxport->mutex);
 
-	if (old_termios &&
-	    !tty_termios_hw_change(&tty->termios, old_termios) &&
-	    tty->termios.c_iflag == old_termios->c_iflag) {
-		dev_dbg(&port->dev, "%s - nothing to change\n", __func__);
-		return;
+	mxport->send_break = (break_state == -1);
+	lcr = mxport->send_break ? MXU1_LCR_BREAK : 0;
+
+	spin_lock_irqsave(&mxport->spinlock, flags);
+	if (mxport->break_head - mxport->break_tail < MXU1_BREAK_INFLIGHT) {
+		stamp = &mxport->break_issued[mxport->break_head %
+					      MXU1_BREAK_INFLIGHT];
+		stamp->issued = ktime_get();
+		stamp->seq = mxport->break_seq;
+		mxport->break_head++;
+		stamped = true;
 	}
+	mxport->break_seq++;
+	spin_unlock_irqrestore(&mxport->spinlock, flags);
 
-	dev_dbg(&port->dev,
-		"%s - cflag 0x%08x, iflag 0x%08x\n", __func__, cflag, iflag);
+	/* a single LCR write, queued in order with any other request */
+	mxu1_port_ctrl_get(mxport);
+	status = mxu1_write_byte(port,
+				 MXU1_UART_BASE_ADDR + MXU1_UART_OFFSET_LCR,
+				 MXU1_LCR_BREAK, lcr, false,
+				 mxu1_break_complete, mxport);
+	if (status) {
+		dev_err(&port->dev, "cannot set break: %d\n", status);
+		mxu1_port_ctrl_put(mxport);
+
+		/* never queued, so it will not complete; it was the last one */
+		spin_lock_irqsave(&mxport->spinlock, flags);
+		if (stamped)
+			mxport->break_head--;
+		mxport->break_seq--;
+		spin_unlock_irqrestore(&mxport->spinlock, flags);
+	}
 
-	if (old_termios) {
-		dev_dbg(&port->dev, "%s - old cflag 0x%08x, old iflag 0x%08x\n",
-			__func__,
-			old_termios->c_cflag,
-			old_termios->c_iflag);
+	mutex_unlock(&mxport->mutex);
+}
+
+/*
+ * Count what the tty flip buffer has no room for as a buffer overrun,
+ * then pass the transfer on to the generic code.
+ */
+static void mxu1_process_read_urb(struct urb *urb)
+{
+	struct usb_serial_port *port = urb->context;
+	int len = urb->actual_length;
+	int room;
+
+	room = tty_buffer_space_avail(&port->port);
+	if (len > room) {
+		dev_dbg(&port->dev, "%s - dropped %d bytes\n",
+			__func__, len - room);
+		port->icount.buf_overrun += len - room;
 	}
 
-	config = kzalloc(sizeof(*config), GFP_KERNEL);
-	if (!config)
-		return;
+	usb_serial_generic_process_read_urb(urb);
+}
 
-	/* these flags must be set */
-	config->wFlags |= MXU1_UART_ENABLE_MS_INTS;
-	config->wFlags |= MXU1_UART_ENABLE_AUTO_START_DMA;
-	if (mxport->send_break)
-		config->wFlags |= MXU1_UART_SEND_BREAK_SIGNAL;
-	config->bUartMode = mxport->uart_mode;
+static void mxu1_read_bulk_callback(struct urb *urb)
+{
+	struct usb_serial_port *port = urb->context;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
+	int status;
 
-	switch (C_CSIZE(tty)) {
-	case CS5:
-		config->bDataBits = MXU1_UART_5_DATA_BITS;
-		break;
-	case CS6:
-		config->bDataBits = MXU1_UART_6_DATA_BITS;
-		break;
-	case CS7:
-		config->bDataBits = MXU1_UART_7_DATA_BITS;
+	switch (urb->status) {
+	case 0:
 		break;
+	case -ECONNRESET:
+	case -ENOENT:
+	case -ESHUTDOWN:
+		dev_dbg(&port->dev, "%s - urb shutting down: %d\n",
+			__func__, urb->status);
+		return;
+	case -EPIPE:
+		dev_err(&port->dev, "%s - urb stopped: %d\n",
+			__func__, urb->status);
+		mxport->rx_errors++;
+		return;
 	default:
-	case CS8:
-		config->bDataBits = MXU1_UART_8_DATA_BITS;
-		break;
+		dev_dbg(&port->dev, "%s - nonzero urb status: %d\n",
+			__func__, urb->status);
+		mxport->rx_errors++;
+		goto resubmit;
 	}
 
-	if (C_PARENB(tty)) {
-		config->wFlags |= MXU1_UART_ENABLE_PARITY_CHECKING;
-		if (C_CMSPAR(tty)) {
-			if (C_PARODD(tty))
-				config->bParity = MXU1_UART_MARK_PARITY;
-			else
-				config->bParity = MXU1_UART_SPACE_PARITY;
-		} else {
-			if (C_PARODD(tty))
-				config->bParity = MXU1_UART_ODD_PARITY;
-			else
-				config->bParity = MXU1_UART_EVEN_PARITY;
+	mxport->rx_completions++;
+	mxport->rx_bytes += urb->actual_length;
+	if (urb->actual_length == urb->transfer_buffer_length)
+		mxport->rx_full++;
+
+	mxu1_process_read_urb(urb);
+	mxu1_adapt_timeout(port, urb);
+
+resubmit:
+	/* park the urb until the tty layer unthrottles us */
+	spin_lock_irqsave(&mxport->rx_lock, flags);
+	if (mxport->rx_throttled) {
+		usb_anchor_urb(urb, &mxport->rx_parked);
+		spin_unlock_irqrestore(&mxport->rx_lock, flags);
+		return;
+	}
+	spin_unlock_irqrestore(&mxport->rx_lock, flags);
+
+	status = usb_submit_urb(urb, GFP_ATOMIC);
+	if (status && status != -EPERM) {
+		dev_err(&port->dev, "%s - resubmit read urb failed: %d\n",
+			__func__, status);
+	}
+}
+
+static void mxu1_rx_free(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int i;
+
+	for (i = 0; i < mxport->rx_urbs_alloc; i++) {
+		usb_free_urb(mxport->rx_urbs[i]);
+		mxport->rx_urbs[i] = NULL;
+	}
+
+	mxport->rx_urbs_alloc = 0;
+}
+
+static int mxu1_rx_alloc(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct usb_device *dev = port->serial->dev;
+	unsigned int count = mxport->rx_urb_count;
+	unsigned int size = mxport->rx_urb_size;
+	struct urb *urb;
+	u8 *buffer;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb)
+			goto err_free;
+
+		buffer = kmalloc(size, GFP_KERNEL);
+		if (!buffer) {
+			usb_free_urb(urb);
+			goto err_free;
 		}
-	} else {
-		config->bParity = MXU1_UART_NO_PARITY;
+
+		usb_fill_bulk_urb(urb, dev,
+				  usb_rcvbulkpipe(dev,
+						  port->bulk_in_endpointAddress),
+				  buffer, size, mxu1_read_bulk_callback, port);
+		urb->transfer_flags |= URB_FREE_BUFFER;
+
+		mxport->rx_urbs[i] = urb;
+		mxport->rx_urbs_alloc++;
 	}
 
-	if (C_CSTOPB(tty))
-		config->bStopBits = MXU1_UART_2_STOP_BITS;
-	else
-		config->bStopBits = MXU1_UART_1_STOP_BITS;
+	dev_dbg(&port->dev, "%s - %u urbs of %u bytes\n",
+		__func__, count, size);
 
-	if (C_CRTSCTS(tty)) {
-		/* RTS flow control must be off to drop RTS for baud rate B0 */
-		if (C_BAUD(tty) != B0)
-			config->wFlags |= MXU1_UART_ENABLE_RTS_IN;
-		config->wFlags |= MXU1_UART_ENABLE_CTS_OUT;
+	return 0;
+
+err_free:
+	mxu1_rx_free(port);
+	return -ENOMEM;
+}
+
+static void mxu1_rx_kill(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int i;
+
+	for (i = 0; i < mxport->rx_urbs_alloc; i++)
+		usb_kill_urb(mxport->rx_urbs[i]);
+
+	usb_scuttle_anchored_urbs(&mxport->rx_parked);
+}
+
+static int mxu1_rx_submit(struct usb_serial_port *port, gfp_t mem_flags)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
+	unsigned int i;
+	int status;
+
+	for (i = 0; i < mxport->rx_urbs_alloc; i++) {
+		spin_lock_irqsave(&mxport->rx_lock, flags);
+		if (mxport->rx_throttled) {
+			usb_anchor_urb(mxport->rx_urbs[i], &mxport->rx_parked);
+			spin_unlock_irqrestore(&mxport->rx_lock, flags);
+			continue;
+		}
+		spin_unlock_irqrestore(&mxport->rx_lock, flags);
+
+		status = usb_submit_urb(mxport->rx_urbs[i], mem_flags);
+		if (status) {
+			dev_err(&port->dev, "%s - submit read urb failed: %d\n",
+				__func__, status);
+			mxu1_rx_kill(port);
+			return status;
+		}
 	}
 
-	if (I_IXOFF(tty) || I_IXON(tty)) {
-		config->cXon  = START_CHAR(tty);
-		config->cXoff = STOP_CHAR(tty);
+	return 0;
+}
 
-		if (I_IXOFF(tty))
-			config->wFlags |= MXU1_UART_ENABLE_X_IN;
+static void mxu1_throttle(struct tty_struct *tty)
+{
+	struct usb_serial_port *port = tty->driver_data;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
 
-		if (I_IXON(tty))
-			config->wFlags |= MXU1_UART_ENABLE_X_OUT;
+	spin_lock_irqsave(&mxport->rx_lock, flags);
+	mxport->rx_throttled = true;
+	spin_unlock_irqrestore(&mxport->rx_lock, flags);
+}
+
+static void mxu1_unthrottle(struct tty_struct *tty)
+{
+	struct usb_serial_port *port = tty->driver_data;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
+	struct urb *urb;
+	int status;
+
+	spin_lock_irqsave(&mxport->rx_lock, flags);
+	mxport->rx_throttled = false;
+	spin_unlock_irqrestore(&mxport->rx_lock, flags);
+
+	while ((urb = usb_get_from_anchor(&mxport->rx_parked))) {
+		status = usb_submit_urb(urb, GFP_KERNEL);
+		if (status) {
+			dev_err(&port->dev, "%s - submit read urb failed: %d\n",
+				__func__, status);
+		}
+		usb_free_urb(urb);
 	}
+}
 
-	baud = tty_get_baud_rate(tty);
-	if (!baud)
-		baud = 9600;
-	config->wBaudRate = MXU1_BAUD_BASE / baud;
+static int mxu1_tx_start(struct usb_serial_port *port, gfp_t mem_flags)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
+	struct urb *urb;
+	int count;
+	int status;
+	int i;
 
-	dev_dbg(&port->dev, "%s - BaudRate=%d, wBaudRate=%d, wFlags=0x%04X, bDataBits=%d, bParity=%d, bStopBits=%d, cXon=%d, cXoff=%d, bUartMode=%d\n",
-		__func__, baud, config->wBaudRate, config->wFlags,
-		config->bDataBits, config->bParity, config->bStopBits,
-		config->cXon, config->cXoff, config->bUartMode);
+	if (test_and_set_bit_lock(0, &mxport->tx_busy))
+		return 0;
+
+retry:
+	spin_lock_irqsave(&port->lock, flags);
+	if (!mxport->tx_urbs_free || !kfifo_len(&port->write_fifo)) {
+		if (kfifo_len(&port->write_fifo))
+			mxport->tx_saturated++;
+		clear_bit_unlock(0, &mxport->tx_busy);
+		spin_unlock_irqrestore(&port->lock, flags);
+		return 0;
+	}
 
-	cpu_to_be16s(&config->wBaudRate);
-	cpu_to_be16s(&config->wFlags);
+	i = __ffs(mxport->tx_urbs_free);
+	__clear_bit(i, &mxport->tx_urbs_free);
 
-	status = mxu1_send_ctrl_data_urb(port->serial, MXU1_SET_CONFIG, 0,
-					 MXU1_UART1_PORT, config,
-					 sizeof(*config));
-	if (status)
-		dev_err(&port->dev, "cannot set config: %d\n", status);
+	urb = mxport->tx_urbs[i];
+	count = kfifo_out(&port->write_fifo, urb->transfer_buffer,
+			  MXU1_TX_URB_SIZE);
+	urb->transfer_buffer_length = count;
 
-	mutex_lock(&mxport->mutex);
-	mcr = mxport->mcr;
+	port->tx_bytes += count;
+	mxport->tx_inflight++;
+	if (mxport->tx_inflight > mxport->tx_inflight_max)
+		mxport->tx_inflight_max = mxport->tx_inflight;
+	mxport->tx_depth_sum += mxport->tx_inflight;
+	mxport->tx_submitted++;
+	spin_unlock_irqrestore(&port->lock, flags);
 
-	if (C_BAUD(tty) == B0)
-		mcr &= ~(MXU1_MCR_DTR | MXU1_MCR_RTS);
-	else if (old_termios && (old_termios->c_cflag & CBAUD) == B0)
-		mcr |= MXU1_MCR_DTR | MXU1_MCR_RTS;
+	usb_serial_debug_data(&port->dev, __func__, count,
+			      urb->transfer_buffer);
 
-	status = mxu1_set_mcr(port, mcr);
-	if (status)
-		dev_err(&port->dev, "cannot set modem control: %d\n", status);
-	else
-		mxport->mcr = mcr;
+	status = usb_submit_urb(urb, mem_flags);
+	if (status) {
+		dev_err_console(port, "%s - submit write urb failed: %d\n",
+				__func__, status);
 
-	mutex_unlock(&mxport->mutex);
+		spin_lock_irqsave(&port->lock, flags);
+		__set_bit(i, &mxport->tx_urbs_free);
+		port->tx_bytes -= count;
+		mxport->tx_inflight--;
+		mxport->tx_submitted--;
+		spin_unlock_irqrestore(&port->lock, flags);
+
+		clear_bit_unlock(0, &mxport->tx_busy);
+		return status;
+	}
 
-	kfree(config);
+	goto retry;	/* keep filling the pipe */
 }
 
-static int mxu1_get_serial_info(struct usb_serial_port *port,
-				struct serial_struct __user *ret_arg)
+/* Nanoseconds the UART needs to shift out count characters */
+static u64 mxu1_char_time_ns(struct mxu1_port *mxport, unsigned int count)
 {
-	struct serial_struct ret_serial;
-	unsigned cwait;
+	return div_u64((u64)count * 10ULL * NSEC_PER_SEC, mxport->baud);
+}
 
-	if (!ret_arg)
-		return -EFAULT;
+/* Account for bytes handed to the device; called with port->lock held */
+static void mxu1_tx_queued(struct usb_serial_port *port, unsigned int count)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	ktime_t now = ktime_get();
+	ktime_t start;
+
+	start = ktime_after(mxport->tx_drain_end, now) ?
+		mxport->tx_drain_end : now;
+	mxport->tx_drain_end = ktime_add_ns(start,
+				mxu1_char_time_ns(mxport, count));
+
+	/* chars_in_buffer drops as the estimate runs out; wake up waiters */
+	mod_delayed_work(system_wq, &mxport->drain_work,
+			 nsecs_to_jiffies(ktime_to_ns(
+				ktime_sub(mxport->tx_drain_end, now))) + 1);
+}
 
-	cwait = port->port.closing_wait;
-	if (cwait != ASYNC_CLOSING_WAIT_NONE)
-		cwait = jiffies_to_msecs(cwait) / 10;
+/* Estimated bytes still queued in the device; called with port->lock held */
+static unsigned int mxu1_dev_chars(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	ktime_t now = ktime_get();
+	u64 remaining;
 
-	memset(&ret_serial, 0, sizeof(ret_serial));
+	if (!ktime_after(mxport->tx_drain_end, now))
+		return 0;
 
-	ret_serial.type = PORT_16550A;
-	ret_serial.line = port->minor;
-	ret_serial.port = 0;
-	ret_serial.xmit_fifo_size = port->bulk_out_size;
-	ret_serial.baud_base = MXU1_BAUD_BASE;
-	ret_serial.close_delay = 5*HZ;
-	ret_serial.closing_wait = cwait;
+	remaining = ktime_to_ns(ktime_sub(mxport->tx_drain_end, now));
 
-	if (copy_to_user(ret_arg, &ret_serial, sizeof(*ret_arg)))
-		return -EFAULT;
+	return div64_u64(remaining * mxport->baud + 10ULL * NSEC_PER_SEC - 1,
+			 10ULL * NSEC_PER_SEC);
+}
 
-	return 0;
+static void mxu1_write_bulk_callback(struct urb *urb)
+{
+	struct usb_serial_port *port = urb->context;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < mxport->tx_urbs_alloc; i++) {
+		if (mxport->tx_urbs[i] == urb)
+			break;
+	}
+
+	if (i == mxport->tx_urbs_alloc) {
+		dev_err(&port->dev, "%s - unknown urb\n", __func__);
+		return;
+	}
+
+	spin_lock_irqsave(&port->lock, flags);
+	port->tx_bytes -= urb->transfer_buffer_length;
+	mxport->tx_inflight--;
+	if (!urb->status) {
+		mxport->tx_total_bytes += urb->actual_length;
+		mxu1_tx_queued(port, urb->actual_length);
+	}
+	__set_bit(i, &mxport->tx_urbs_free);
+	spin_unlock_irqrestore(&port->lock, flags);
+
+	switch (urb->status) {
+	case 0:
+		break;
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+		dev_dbg(&port->dev, "%s - urb stopped: %d\n",
+			__func__, urb->status);
+		goto wakeup;
+	case -EPIPE:
+		dev_err_console(port, "%s - urb stopped: %d\n",
+				__func__, urb->status);
+		mxport->tx_errors++;
+		goto wakeup;
+	default:
+		dev_err_console(port, "%s - nonzero urb status: %d\n",
+				__func__, urb->status);
+		mxport->tx_errors++;
+		break;
+	}
+
+	mxu1_tx_start(port, GFP_ATOMIC);
+wakeup:
+	/* writers waiting for room or for the port to drain */
+	usb_serial_port_softint(port);
 }
 
+static void mxu1_tx_free(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int i;
 
-static int mxu1_set_serial_info(struct usb_serial_port *port,
-				struct serial_struct __user *new_arg)
+	for (i = 0; i < mxport->tx_urbs_alloc; i++) {
+		usb_free_urb(mxport->tx_urbs[i]);
+		mxport->tx_urbs[i] = NULL;
+	}
+
+	mxport->tx_urbs_alloc = 0;
+	mxport->tx_urbs_free = 0;
+}
+
+static int mxu1_tx_alloc(struct usb_serial_port *port)
 {
-	struct serial_struct new_serial;
-	unsigned cwait;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct usb_device *dev = port->serial->dev;
+	unsigned int count = mxport->tx_urb_count;
+	struct urb *urb;
+	u8 *buffer;
+	unsigned int i;
 
-	if (copy_from_user(&new_serial, new_arg, sizeof(new_serial)))
-		return -EFAULT;
+	for (i = 0; i < count; i++) {
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb)
+			goto err_free;
 
-	cwait = new_serial.closing_wait;
-	if (cwait != ASYNC_CLOSING_WAIT_NONE)
-		cwait = msecs_to_jiffies(10 * new_serial.closing_wait);
+		buffer = kmalloc(MXU1_TX_URB_SIZE, GFP_KERNEL);
+		if (!buffer) {
+			usb_free_urb(urb);
+			goto err_free;
+		}
+
+		usb_fill_bulk_urb(urb, dev,
+				  usb_sndbulkpipe(dev,
+						  port->bulk_out_endpointAddress),
+				  buffer, MXU1_TX_URB_SIZE,
+				  mxu1_write_bulk_callback, port);
+		urb->transfer_flags |= URB_FREE_BUFFER;
+
+		mxport->tx_urbs[i] = urb;
+		mxport->tx_urbs_alloc++;
+	}
+
+	mxport->tx_urbs_free = (1UL << count) - 1;
+	mxport->tx_inflight = 0;
+
+	return 0;
+
+err_free:
+	mxu1_tx_free(port);
+	return -ENOMEM;
+}
+
+static void mxu1_tx_kill(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	unsigned int i;
+
+	for (i = 0; i < mxport->tx_urbs_alloc; i++)
+		usb_kill_urb(mxport->tx_urbs[i]);
+}
+
+static int mxu1_write(struct tty_struct *tty, struct usb_serial_port *port,
+		      const unsigned char *buf, int count)
+{
+	int status;
+
+	if (!count)
+		return 0;
 
-	port->port.closing_wait = cwait;
+	count = kfifo_in_locked(&port->write_fifo, buf, count, &port->lock);
 
-	return 0;
+	status = mxu1_tx_start(port, GFP_ATOMIC);
+	if (status)
+		return status;
+
+	return count;
 }
 
-static int mxu1_ioctl(struct tty_struct *tty,
-		      unsigned int cmd, unsigned long arg)
+static int mxu1_chars_in_buffer(struct tty_struct *tty)
 {
 	struct usb_serial_port *port = tty->driver_data;
+	unsigned long flags;
+	int chars;
 
-	switch (cmd) {
-	case TIOCGSERIAL:
-		return mxu1_get_serial_info(port,
-					    (struct serial_struct __user *)arg);
-	case TIOCSSERIAL:
-		return mxu1_set_serial_info(port,
-					    (struct serial_struct __user *)arg);
-	}
+	spin_lock_irqsave(&port->lock, flags);
+	chars = kfifo_len(&port->write_fifo) + port->tx_bytes +
+		mxu1_dev_chars(port);
+	spin_unlock_irqrestore(&port->lock, flags);
 
-	return -ENOIOCTLCMD;
+	dev_dbg(&port->dev, "%s - %d\n", __func__, chars);
+
+	return chars;
 }
 
-static int mxu1_tiocmget(struct tty_struct *tty)
+static bool mxu1_tx_empty(struct usb_serial_port *port)
 {
-	struct usb_serial_port *port = tty->driver_data;
 	struct mxu1_port *mxport = usb_get_serial_port_data(port);
-	unsigned int result;
-	unsigned int msr;
-	unsigned int mcr;
+	unsigned int queued;
 	unsigned long flags;
+	bool empty;
+	u8 lsr;
 
-	mutex_lock(&mxport->mutex);
-	spin_lock_irqsave(&mxport->spinlock, flags);
+	spin_lock_irqsave(&port->lock, flags);
+	empty = !kfifo_len(&port->write_fifo) && !port->tx_bytes;
+	spin_unlock_irqrestore(&port->lock, flags);
 
-	msr = mxport->msr;
-	mcr = mxport->mcr;
+	if (!empty)
+		return false;
 
-	spin_unlock_irqrestore(&mxport->spinlock, flags);
-	mutex_unlock(&mxport->mutex);
+	if (!mxu1_get_outqueue(port, &queued)) {
+		mxport->tx_dev_queued = queued;
+		if (queued)
+			return false;
+	}
 
-	result = ((mcr & MXU1_MCR_DTR)	? TIOCM_DTR	: 0) |
-		 ((mcr & MXU1_MCR_RTS)	? TIOCM_RTS	: 0) |
-		 ((mcr & MXU1_MCR_LOOP) ? TIOCM_LOOP	: 0) |
-		 ((msr & MXU1_MSR_CTS)	? TIOCM_CTS	: 0) |
-		 ((msr & MXU1_MSR_CD)	? TIOCM_CAR	: 0) |
-		 ((msr & MXU1_MSR_RI)	? TIOCM_RI	: 0) |
-		 ((msr & MXU1_MSR_DSR)	? TIOCM_DSR	: 0);
+	if (!mxu1_get_lsr(port, &lsr) && !(lsr & MXU1_LSR_TX_EMPTY)) {
+		mxport->tx_dev_queued = 1;
+		return false;
+	}
 
-	dev_dbg(&port->dev, "%s - 0x%04X\n", __func__, result);
+	spin_lock_irqsave(&port->lock, flags);
+	mxport->tx_drain_end = ktime_get();
+	spin_unlock_irqrestore(&port->lock, flags);
 
-	return result;
+	return true;
 }
 
-static int mxu1_tiocmset(struct tty_struct *tty,
-			 unsigned int set, unsigned int clear)
+/*
+ * Poll the device until it has shifted out everything, sleeping for the
+ * time the reported queue needs on the wire at the current baud rate.
+ */
+static void mxu1_wait_until_sent(struct tty_struct *tty, long timeout)
 {
 	struct usb_serial_port *port = tty->driver_data;
 	struct mxu1_port *mxport = usb_get_serial_port_data(port);
-	int err;
-	unsigned int mcr;
-
-	mutex_lock(&mxport->mutex);
-	mcr = mxport->mcr;
-
-	if (set & TIOCM_RTS)
-		mcr |= MXU1_MCR_RTS;
-	if (set & TIOCM_DTR)
-		mcr |= MXU1_MCR_DTR;
-	if (set & TIOCM_LOOP)
-		mcr |= MXU1_MCR_LOOP;
-
-	if (clear & TIOCM_RTS)
-		mcr &= ~MXU1_MCR_RTS;
-	if (clear & TIOCM_DTR)
-		mcr &= ~MXU1_MCR_DTR;
-	if (clear & TIOCM_LOOP)
-		mcr &= ~MXU1_MCR_LOOP;
+	unsigned long expire;
+	unsigned long period;
 
-	err = mxu1_set_mcr(port, mcr);
-	if (!err)
-		mxport->mcr = mcr;
+	dev_dbg(&port->dev, "%s - timeout %ld\n", __func__, timeout);
 
-	mutex_unlock(&mxport->mutex);
+	expire = jiffies + timeout;
+	while (!mxu1_tx_empty(port)) {
+		period = nsecs_to_jiffies(mxu1_char_time_ns(mxport,
+						mxport->tx_dev_queued));
+		period = max_t(unsigned long, period, 1);
+		if (timeout)
+			period = min_t(unsigned long, period, timeout);
 
-	return err;
+		schedule_timeout_interruptible(period);
+		if (signal_pending(current))
+			break;
+		if (timeout && time_after(jiffies, expire))
+			break;
+		if (mxu1_device_gone(port->serial))
+			break;
+	}
 }
 
-static void mxu1_break(struct tty_struct *tty, int break_state)
+static void mxu1_open_latency(struct mxu1_port *mxport, s64 us,
+			      bool lingered)
 {
-	struct usb_serial_port *port = tty->driver_data;
-	struct mxu1_port *mxport = usb_get_serial_port_data(port);
-
-	if (break_state == -1)
-		mxport->send_break = true;
-	else
-		mxport->send_break = false;
+	unsigned long flags;
 
-	mxu1_set_termios(tty, port, NULL);
+	spin_lock_irqsave(&mxport->spinlock, flags);
+	if (lingered)
+		mxport->open_lingered++;
+	if (!mxport->open_count || us < mxport->open_min_us)
+		mxport->open_min_us = us;
+	if (us > mxport->open_max_us)
+		mxport->open_max_us = us;
+	mxport->open_last_us = us;
+	mxport->open_total_us += us;
+	mxport->open_count++;
+	spin_unlock_irqrestore(&mxport->spinlock, flags);
 }
 
 static int mxu1_open(struct tty_struct *tty, struct usb_serial_port *port)
 {
 	struct mxu1_port *mxport = usb_get_serial_port_data(port);
 	struct usb_serial *serial = port->serial;
+	struct mxu1_ctrl_batch batch;
+	bool lingering;
+	int alloc_status;
+	ktime_t start;
 	int status;
 	u16 open_settings;
 
-	open_settings = (MXU1_PIPE_MODE_CONTINUOUS |
-			 MXU1_PIPE_TIMEOUT_ENABLE |
-			 (MXU1_TRANSFER_TIMEOUT << 2));
+	mxu1_adapt_reset(mxport);
+	open_settings = mxu1_open_settings(mxport);
 
-	mxport->msr = 0;
+	/*
+	 * A port still lingering from the last close is open and started
+	 * in the device, and its config, mcr and msr are still current.
+	 */
+	cancel_delayed_work_sync(&mxport->linger_work);
 
-	status = usb_submit_urb(port->interrupt_in_urb, GFP_KERNEL);
-	if (status) {
-		dev_err(&port->dev, "failed to submit interrupt urb: %d\n",
-			status);
-		return status;
+	mutex_lock(&mxport->mutex);
+	lingering = mxport->dev_open;
+	if (!lingering) {
+		/* the device port state is unknown until configured again */
+		mxport->config_valid = false;
+		mxport->mcr_valid = false;
 	}
+	mutex_unlock(&mxport->mutex);
 
-	if (tty)
-		mxu1_set_termios(tty, port, NULL);
-
-	status = mxu1_send_ctrl_urb(serial, MXU1_OPEN_PORT,
-				    open_settings, MXU1_UART1_PORT);
-	if (status) {
-		dev_err(&port->dev, "cannot send open command: %d\n", status);
-		goto unlink_int_urb;
-	}
+	if (!lingering) {
+		mxu1_modem_store(mxport, MXU1_MODEM_MSR_SHIFT, 0);
+		mxu1_msr_reset(mxport);
 
-	status = mxu1_send_ctrl_urb(serial, MXU1_START_PORT,
-				    0, MXU1_UART1_PORT);
-	if (status) {
-		dev_err(&port->dev, "cannot send start command: %d\n", status);
-		goto unlink_int_urb;
+		status = mxu1_int_submit(port, GFP_KERNEL);
+		if (status) {
+			dev_err(&port->dev,
+				"failed to submit interrupt urb: %d\n", status);
+			return status;
+		}
 	}
 
-	status = mxu1_send_ctrl_urb(serial, MXU1_PURGE_PORT,
-				    MXU1_PURGE_INPUT, MXU1_UART1_PORT);
-	if (status) {
-		dev_err(&port->dev, "cannot clear input buffers: %d\n",
-			status);
+	/*
+	 * Queue the whole open sequence at once; the device queue keeps it
+	 * in order and issues each request from the previous completion.
+	 * The urbs are allocated while the requests are on the wire.
+	 */
+	start = ktime_get();
 
-		goto unlink_int_urb;
+	if (tty)
+		mxu1_change_termios(tty, port, NULL, false);
+
+	mxu1_batch_init(&batch);
+	if (!lingering || mxport->dev_settings != open_settings) {
+		mxu1_batch_send(serial, MXU1_OPEN_PORT, open_settings,
+				MXU1_UART1_PORT, &batch);
+		mxu1_batch_send(serial, MXU1_START_PORT, 0,
+				MXU1_UART1_PORT, &batch);
+	}
+	mxu1_batch_send(serial, MXU1_PURGE_PORT, MXU1_PURGE_INPUT,
+			MXU1_UART1_PORT, &batch);
+	mxu1_batch_send(serial, MXU1_PURGE_PORT, MXU1_PURGE_OUTPUT,
+			MXU1_UART1_PORT, &batch);
+
+	alloc_status = mxu1_rx_alloc(port);
+	if (!alloc_status) {
+		alloc_status = mxu1_tx_alloc(port);
+		if (alloc_status)
+			mxu1_rx_free(port);
 	}
 
-	status = mxu1_send_ctrl_urb(serial, MXU1_PURGE_PORT,
-				    MXU1_PURGE_OUTPUT, MXU1_UART1_PORT);
+	status = mxu1_batch_wait(&batch);
 	if (status) {
-		dev_err(&port->dev, "cannot clear output buffers: %d\n",
-			status);
-
+		dev_err(&port->dev, "cannot open port: %d\n", status);
+		if (!alloc_status) {
+			mxu1_tx_free(port);
+			mxu1_rx_free(port);
+		}
 		goto unlink_int_urb;
 	}
 
-	status = usb_serial_generic_open(tty, port);
+	status = alloc_status;
 	if (status)
 		goto unlink_int_urb;
 
+	mxport->rx_throttled = false;
+
+	status = mxu1_rx_submit(port, GFP_KERNEL);
+	if (status)
+		goto free_tx_urbs;
+
+	mutex_lock(&mxport->mutex);
+	mxport->dev_open = true;
+	mxport->dev_settings = open_settings;
+	mutex_unlock(&mxport->mutex);
+
+	mxu1_open_latency(mxport, ktime_us_delta(ktime_get(), start),
+			  lingering);
+
 	return 0;
 
+free_tx_urbs:
+	mxu1_tx_free(port);
+	mxu1_rx_free(port);
 unlink_int_urb:
-	usb_kill_urb(port->interrupt_in_urb);
+	mutex_lock(&mxport->mutex);
+	mxu1_int_kill(port);
+	mxport->dev_open = false;
+	mutex_unlock(&mxport->mutex);
 
 	return status;
 }
 
 static void mxu1_close(struct usb_serial_port *port)
 {
-	int status;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
 
 	usb_serial_generic_close(port);
-	usb_kill_urb(port->interrupt_in_urb);
-
-	status = mxu1_send_ctrl_urb(port->serial, MXU1_STOP_PORT,
-				    0, MXU1_UART1_PORT);
-	if (status) {
-		dev_err(&port->dev, "failed to send stop port command: %d\n",
-			status);
+	mxu1_tx_kill(port);
+	mxu1_tx_free(port);
+	mxu1_rx_kill(port);
+	mxu1_rx_free(port);
+	cancel_work_sync(&mxport->adapt_work);
+	cancel_delayed_work_sync(&mxport->drain_work);
+	mxport->tx_drain_end = ktime_set(0, 0);
+
+	/*
+	 * Abort requests still waiting on a vanished device before taking
+	 * the mutex, which such a request's caller may be holding.
+	 */
+	if (mxu1_device_gone(port->serial))
+		mxu1_ctrl_flush(usb_get_serial_data(port->serial));
+
+	/*
+	 * Keep the device side port open and the modem status current for
+	 * a while; data received meanwhile stays in the device and is
+	 * purged by the next open like on a full open.
+	 */
+	if (mxport->close_linger && !mxu1_device_gone(port->serial)) {
+		schedule_delayed_work(&mxport->linger_work,
+				      msecs_to_jiffies(mxport->close_linger));
+		return;
 	}
 
-	status = mxu1_send_ctrl_urb(port->serial, MXU1_CLOSE_PORT,
-				    0, MXU1_UART1_PORT);
-	if (status) {
-		dev_err(&port->dev, "failed to send close port command: %d\n",
-			status);
-	}
+	mutex_lock(&mxport->mutex);
+	mxu1_port_shutdown(port);
+	mutex_unlock(&mxport->mutex);
+}
+
+/*
+ * Pass a carrier change on to the line discipline, which lets the PPS
+ * line discipline (ldattach PPS) timestamp DCD pulses from a GNSS
+ * receiver, and hang up on carrier loss unless CLOCAL is set.
+ *
+ * The timestamp is taken in the interrupt urb completion, so it lags
+ * the edge by the device sampling the line, the wait for the next poll
+ * of the interrupt endpoint (bInterval, at least 1 ms at full speed)
+ * and the host controller completion latency.  Expect jitter on the
+ * order of a millisecond; this is called before anything else in the
+ * completion so as not to add to it.
+ */
+static void mxu1_handle_dcd_change(struct usb_serial_port *port, u8 msr)
+{
+	struct tty_struct *tty;
+
+	tty = tty_port_tty_get(&port->port);
+	if (!tty)
+		return;
+
+	usb_serial_handle_dcd_change(port, tty, msr & MXU1_MSR_CD);
+	tty_kref_put(tty);
 }
 
 static void mxu1_handle_new_msr(struct usb_serial_port *port, u8 msr)
 {
 	struct mxu1_port *mxport = usb_get_serial_port_data(port);
 	struct async_icount *icount;
-	unsigned long flags;
+
+	if (msr & MXU1_MSR_DELTA_CD)
+		mxu1_handle_dcd_change(port, msr);
 
 	dev_dbg(&port->dev, "%s - msr 0x%02X\n", __func__, msr);
 
-	spin_lock_irqsave(&mxport->spinlock, flags);
-	mxport->msr = msr & MXU1_MSR_MASK;
-	spin_unlock_irqrestore(&mxport->spinlock, flags);
+	mxu1_modem_store(mxport, MXU1_MODEM_MSR_SHIFT, msr & MXU1_MSR_MASK);
+	mxu1_msr_record(mxport, msr);
 
 	if (msr & MXU1_MSR_DELTA_MASK) {
 		icount = &port->icount;
@@ -906,17 +3819,77 @@ static void mxu1_handle_new_msr(struct usb_serial_port *port, u8 msr)
 			icount->rng++;
 
 		wake_up_interruptible(&port->port.delta_msr_wait);
+		if (mxport->modem_kn)
+			sysfs_notify_dirent(mxport->modem_kn);
+	}
+}
+
+static void mxu1_handle_new_lsr(struct usb_serial_port *port, u8 lsr)
+{
+	struct async_icount *icount = &port->icount;
+
+	if (lsr & MXU1_LSR_OVERRUN_ERROR)
+		icount->overrun++;
+	if (lsr & MXU1_LSR_PARITY_ERROR)
+		icount->parity++;
+	if (lsr & MXU1_LSR_FRAMING_ERROR)
+		icount->frame++;
+	if (lsr & MXU1_LSR_BREAK)
+		icount->brk++;
+}
+
+/* Handle one two byte interrupt record: a code and its data */
+static void mxu1_handle_int_record(struct usb_serial_port *port,
+				   const u8 *record)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	int function;
+
+	mxport->int_records++;
+
+	if (record[0] == MXU1_CODE_HARDWARE_ERROR) {
+		mxport->int_hw_errors++;
+		dev_err(&port->dev, "hardware error: %d\n", record[1]);
+		return;
+	}
+
+	function = mxu1_get_func_from_code(record[0]);
+
+	dev_dbg(&port->dev, "%s - function %d, data 0x%02X\n",
+		 __func__, function, record[1]);
+
+	switch (function) {
+	case MXU1_CODE_DATA_ERROR:
+		dev_dbg(&port->dev, "%s - DATA ERROR, data 0x%02X\n",
+			 __func__, record[1]);
+		mxu1_handle_new_lsr(port, record[1]);
+		break;
+
+	case MXU1_CODE_MODEM_STATUS:
+		mxu1_handle_new_msr(port, record[1]);
+		break;
+
+	default:
+		mxport->int_unknown++;
+		dev_err(&port->dev, "unknown interrupt code: 0x%02X\n",
+			record[1]);
+		break;
 	}
 }
 
+/*
+ * Completion of either interrupt urb.  Both are queued on the endpoint,
+ * so they complete alternately and never concurrently; a transfer may
+ * carry several records.
+ */
 static void mxu1_interrupt_callback(struct urb *urb)
 {
 	struct usb_serial_port *port = urb->context;
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
 	unsigned char *data = urb->transfer_buffer;
 	int length = urb->actual_length;
-	int function;
+	int pos;
 	int status;
-	u8 msr;
 
 	switch (urb->status) {
 	case 0:
@@ -928,50 +3901,157 @@ static void mxu1_interrupt_callback(struct urb *urb)
 			__func__, urb->status);
 		return;
 	default:
+		mxport->int_urb_errors++;
 		dev_dbg(&port->dev, "%s - nonzero urb status: %d\n",
 			__func__, urb->status);
 		goto exit;
 	}
 
-	if (length != 2) {
+	if (length % MXU1_INT_RECORD_SIZE) {
+		mxport->int_malformed++;
 		dev_dbg(&port->dev, "%s - bad packet size: %d\n",
 			__func__, length);
-		goto exit;
+		length -= length % MXU1_INT_RECORD_SIZE;
 	}
 
-	if (data[0] == MXU1_CODE_HARDWARE_ERROR) {
-		dev_err(&port->dev, "hardware error: %d\n", data[1]);
-		goto exit;
+	for (pos = 0; pos < length; pos += MXU1_INT_RECORD_SIZE)
+		mxu1_handle_int_record(port, data + pos);
+
+exit:
+	status = usb_submit_urb(urb, GFP_ATOMIC);
+	if (status) {
+		dev_err(&port->dev, "resubmit interrupt urb failed: %d\n",
+			status);
 	}
+}
 
-	function = mxu1_get_func_from_code(data[0]);
+static int mxu1_suspend(struct usb_serial *serial, pm_message_t message)
+{
+	int i;
 
-	dev_dbg(&port->dev, "%s - function %d, data 0x%02X\n",
-		 __func__, function, data[1]);
+	for (i = 0; i < serial->num_ports; i++) {
+		mxu1_rx_kill(serial->port[i]);
+		mxu1_tx_kill(serial->port[i]);
+		mxu1_int_kill(serial->port[i]);
+	}
 
-	switch (function) {
-	case MXU1_CODE_DATA_ERROR:
-		dev_dbg(&port->dev, "%s - DATA ERROR, data 0x%02X\n",
-			 __func__, data[1]);
-		break;
+	return 0;
+}
 
-	case MXU1_CODE_MODEM_STATUS:
-		msr = data[1];
-		mxu1_handle_new_msr(port, msr);
-		break;
+static int mxu1_resume(struct usb_serial *serial)
+{
+	struct mxu1_port *mxport;
+	struct usb_serial_port *port;
+	int c = 0;
+	int i;
 
-	default:
-		dev_err(&port->dev, "unknown interrupt code: 0x%02X\n",
-			data[1]);
-		break;
+	for (i = 0; i < serial->num_ports; i++) {
+		port = serial->port[i];
+		mxport = usb_get_serial_port_data(port);
+
+		/* a lingering port keeps its modem status updates */
+		mutex_lock(&mxport->mutex);
+		if (mxport->dev_open && mxu1_int_submit(port, GFP_NOIO))
+			c++;
+		mutex_unlock(&mxport->mutex);
+
+		if (!test_bit(ASYNCB_INITIALIZED, &port->port.flags))
+			continue;
+
+		if (mxu1_rx_submit(port, GFP_NOIO))
+			c++;
+		if (mxu1_tx_start(port, GFP_NOIO))
+			c++;
 	}
 
-exit:
-	status = usb_submit_urb(urb, GFP_ATOMIC);
-	if (status) {
-		dev_err(&port->dev, "resubmit interrupt urb failed: %d\n",
-			status);
+	return c ? -EIO : 0;
+}
+
+/* Bring the device side state of a port back after a device reset */
+static int mxu1_port_restore(struct usb_serial_port *port)
+{
+	struct mxu1_port *mxport = usb_get_serial_port_data(port);
+	struct tty_struct *tty;
+	struct mxu1_ctrl_batch batch;
+	int status;
+
+	mutex_lock(&mxport->mutex);
+	if (!mxport->dev_open) {
+		mutex_unlock(&mxport->mutex);
+		return 0;
+	}
+	mxport->config_valid = false;
+	mxport->mcr_valid = false;
+	mutex_unlock(&mxport->mutex);
+
+	mxu1_batch_init(&batch);
+	mxu1_batch_send(port->serial, MXU1_OPEN_PORT, mxport->dev_settings,
+			MXU1_UART1_PORT, &batch);
+	mxu1_batch_send(port->serial, MXU1_START_PORT, 0,
+			MXU1_UART1_PORT, &batch);
+	status = mxu1_batch_wait(&batch);
+	if (status)
+		return status;
+
+	/* a lingering port is configured again by its next open */
+	tty = tty_port_tty_get(&port->port);
+	if (tty) {
+		mxu1_change_termios(tty, port, NULL, true);
+		tty_kref_put(tty);
+	}
+
+	return 0;
+}
+
+/*
+ * The device was reset while suspended.  If the firmware is still
+ * running, reopen the ports in place instead of having the interface
+ * rebound, which would download the firmware and re-enumerate.
+ */
+static int mxu1_reset_resume(struct usb_serial *serial)
+{
+	struct mxu1_device *mxdev = usb_get_serial_data(serial);
+	ktime_t start = ktime_get();
+	s64 us;
+	int status;
+	int i;
+
+	if (serial->interface->cur_altsetting->desc.bNumEndpoints == 1) {
+		status = -ENODEV;
+		goto rebind;
+	}
+
+	status = mxu1_get_version(serial, &mxdev->fw_version);
+	if (status)
+		goto rebind;
+
+	mxdev->fw_version_valid = true;
+	dev_dbg(&serial->interface->dev, "%s - firmware version %u.%u\n",
+		__func__, mxdev->fw_version.bMajor, mxdev->fw_version.bMinor);
+
+	for (i = 0; i < serial->num_ports; i++) {
+		status = mxu1_port_restore(serial->port[i]);
+		if (status)
+			goto rebind;
 	}
+
+	status = mxu1_resume(serial);
+
+	us = ktime_us_delta(ktime_get(), start);
+	mxdev->recoveries++;
+	mxdev->recovery_last_us = us;
+
+	dev_dbg(&serial->interface->dev, "%s - recovered in %lld us\n",
+		__func__, us);
+
+	return status;
+
+rebind:
+	dev_dbg(&serial->interface->dev, "%s - firmware lost: %d\n",
+		__func__, status);
+	serial->interface->needs_binding = 1;
+
+	return status;
 }
 
 static struct usb_serial_driver mxu11x0_device = {
@@ -986,9 +4066,14 @@ static struct usb_serial_driver mxu11x0_device = {
 	.port_probe             = mxu1_port_probe,
 	.port_remove            = mxu1_port_remove,
 	.attach			= mxu1_startup,
+	.disconnect             = mxu1_disconnect,
 	.release                = mxu1_release,
 	.open			= mxu1_open,
 	.close			= mxu1_close,
+	.write			= mxu1_write,
+	.chars_in_buffer	= mxu1_chars_in_buffer,
+	.tx_empty		= mxu1_tx_empty,
+	.wait_until_sent	= mxu1_wait_until_sent,
 	.ioctl			= mxu1_ioctl,
 	.set_termios		= mxu1_set_termios,
 	.tiocmget		= mxu1_tiocmget,
@@ -996,14 +4081,48 @@ static struct usb_serial_driver mxu11x0_device = {
 	.tiocmiwait		= usb_serial_generic_tiocmiwait,
 	.get_icount		= usb_serial_generic_get_icount,
 	.break_ctl		= mxu1_break,
+	.throttle		= mxu1_throttle,
+	.unthrottle		= mxu1_unthrottle,
 	.read_int_callback	= mxu1_interrupt_callback,
+	.suspend		= mxu1_suspend,
+	.resume			= mxu1_resume,
+	.reset_resume		= mxu1_reset_resume,
 };
 
 static struct usb_serial_driver *const serial_drivers[] = {
 	&mxu11x0_device, NULL
 };
 
-module_usb_serial_driver(serial_drivers, mxu1_idtable);
+static int __init mxu1_init(void)
+{
+	int err;
+
+	mxu1_fw_wq = alloc_workqueue("mxu11x0_fw", WQ_UNBOUND, 0);
+	if (!mxu1_fw_wq)
+		return -ENOMEM;
+
+	mxu1_debugfs = debugfs_create_dir(KBUILD_MODNAME, NULL);
+
+	err = usb_serial_register_drivers(serial_drivers, KBUILD_MODNAME,
+					  mxu1_idtable);
+	if (err) {
+		debugfs_remove_recursive(mxu1_debugfs);
+		destroy_workqueue(mxu1_fw_wq);
+	}
+
+	return err;
+}
+
+static void __exit mxu1_exit(void)
+{
+	usb_serial_deregister_drivers(serial_drivers);
+	debugfs_remove_recursive(mxu1_debugfs);
+	destroy_workqueue(mxu1_fw_wq);
+	mxu1_free_firmware();
+}
+
+module_init(mxu1_init);
+module_exit(mxu1_exit);
 
 MODULE_AUTHOR("Mathieu Othacehe <m.othacehe@gmail.com>");
 MODULE_DESCRIPTION("MOXA UPort 11x0 USB to Serial Hub Driver");
@@ -121,6 +121,21 @@
 /* User define ioctl */
 #define MOXA					404
 #define MOXA_SET_INTERFACE			(MOXA + 1)
+#define MOXA_GET_MSR_EVENTS			(MOXA + 2)
+
+/* One modem status change, msr including the delta bits */
+struct mxu1_msr_event {
+	__u64	timestamp_ns;	/* CLOCK_MONOTONIC */
+	__u8	msr;
+	__u8	reserved[7];
+};
+
+/* Argument of MOXA_GET_MSR_EVENTS */
+struct mxu1_msr_events {
+	__u32	count;		/* in: room in events, out: events returned */
+	__u32	dropped;	/* out: events lost since the last call */
+	__u64	events;		/* user pointer to struct mxu1_msr_event[] */
+};
 
 /* Config struct */
 struct mxu1_uart_config {